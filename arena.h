@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+
+constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// Fixed size block of trivially copyable objects, allocated once and never moved.
+// Large blocks are backed by huge pages when the system allows it
+template <class _T>
+class Arena {
+public:
+    static_assert(std::is_trivially_copyable<_T>::value, "POD expected");
+
+    Arena(): _data(nullptr), _size(0), _capacity(0), _bytes(0), _huge(false) {
+    }
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena() {
+        release();
+    }
+    void reserve(size_t capacity) {
+        release();
+        _bytes = std::max<size_t>(capacity, 1) * sizeof(_T);
+        _data = static_cast<_T *>(allocate(_bytes, _huge));
+        _capacity = capacity;
+        _size = 0;
+    }
+    _T *alloc(size_t n) {
+        assert(_size + n <= _capacity);
+        _T *result = _data + _size;
+        _size += n;
+        return result;
+    }
+    // array of objects of another type placed in the same block, it takes a whole number of elements
+    template <class _U>
+    _U *alloc_as(size_t n) {
+        static_assert(std::is_trivially_copyable<_U>::value, "POD expected");
+        static_assert(sizeof(_T) % alignof(_U) == 0, "incompatible layout");
+        return reinterpret_cast<_U *>(alloc((n * sizeof(_U) + sizeof(_T) - 1) / sizeof(_T)));
+    }
+    void release() {
+        if (_data != nullptr) {
+            deallocate(_data, _bytes);
+        }
+        _data = nullptr;
+        _size = _capacity = _bytes = 0;
+        _huge = false;
+    }
+    size_t size() const {
+        return _size;
+    }
+    size_t bytes() const {
+        return _size * sizeof(_T);
+    }
+    bool huge() const {
+        return _huge;
+    }
+    _T *data() {
+        return _data;
+    }
+    const _T *data() const {
+        return _data;
+    }
+    size_t index(const _T *p) const {
+        return static_cast<size_t>(p - _data);
+    }
+private:
+    static void *allocate(size_t &bytes, bool &huge) {
+        huge = false;
+#ifdef _WIN32
+        SIZE_T large = GetLargePageMinimum();
+        if ((large > 0) && (bytes >= large)) {
+            // requires "Lock pages in memory" privilege, silently falls back otherwise
+            size_t rounded = (bytes + large - 1) / large * large;
+            void *p = VirtualAlloc(nullptr, rounded, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (p != nullptr) {
+                bytes = rounded;
+                huge = true;
+                return p;
+            }
+        }
+        void *p = VirtualAlloc(nullptr, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+        if (bytes >= HUGE_PAGE_SIZE) {
+            size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            void *p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                bytes = rounded;
+                huge = true;
+                return p;
+            }
+        }
+        void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            p = nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        else if (bytes >= HUGE_PAGE_SIZE) {
+            // transparent huge pages, if they are enabled
+            madvise(p, bytes, MADV_HUGEPAGE);
+        }
+#endif
+#endif
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    static void deallocate(void *p, size_t bytes) {
+#ifdef _WIN32
+        (void)bytes;
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        munmap(p, bytes);
+#endif
+    }
+
+    _T          *_data;
+    size_t      _size;
+    size_t      _capacity;
+    size_t      _bytes;
+    bool        _huge;
+};
@@ -96,6 +96,9 @@ public:
     std::string key() const {
         return "";
     }
+    uint32_t allowed(const std::string &clear, const std::string &cipher) const {
+        return ALL_SYMBOLS & ~symbol_bit(cipher[clear.size()]);
+    }
     bool push(const std::string &clear, const std::string &cipher, char ch) {
         if (ch == cipher[clear.size()]) {
             return false;
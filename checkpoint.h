@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+
+constexpr uint64_t CHECKPOINT_MAGIC = 0x54504b4346594c50; // "PLYFCKPT"
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+// What a checkpoint keeps of a task: the iterations done, the parts of the current one which are not searched
+// yet and the solutions found so far. A part is a cleartext prefix, or the siblings lo..hi - 1 down its path.
+// An iteration without parts starts from the root
+struct Task_State {
+    struct Part {
+        std::string             prefix;
+        std::vector<uint32_t>   path;
+        uint32_t                lo;
+        uint32_t                hi;
+    };
+
+    bool                finished;
+    uint64_t            iteration;
+    std::vector<Part>   parts;
+    std::map<score_t, std::set<Word_List>>  solutions;
+};
+
+// The states of the tasks of a run, saved in a file from time to time, so a run which has been stopped resumes
+// where it was. A thread of its own collects the states of the running tasks and writes them, so the workers
+// only wait while their pending works are copied. The file is replaced at once, a run killed while saving keeps
+// the previous checkpoint. The word ids are valid with the dictionary it has been saved with only
+class Checkpoint {
+public:
+    using Source = std::function<Task_State()>;
+
+    Checkpoint(const std::string &filename, uint64_t dict_key, std::chrono::seconds interval):
+    _filename(filename), _dict_key(dict_key), _interval(interval), _stop(false) {
+        load();
+        _thread = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(_wait_mtx);
+            while (!_cv.wait_for(lock, _interval, [this]() { return _stop; })) {
+                lock.unlock();
+                save();
+                lock.lock();
+            }
+        });
+    }
+    Checkpoint(const Checkpoint &) = delete;
+    Checkpoint &operator=(const Checkpoint &) = delete;
+    ~Checkpoint() {
+        {
+            std::lock_guard<std::mutex> lock(_wait_mtx);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+        save();
+    }
+    // the saved state of a task, false if there is none
+    bool find(uint64_t key, Task_State &state) const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = _states.find(key);
+        if (it == _states.end()) {
+            return false;
+        }
+        state = it->second;
+        return true;
+    }
+    // the state of a running task is taken from the source, until the task updates it
+    void track(uint64_t key, const Source &source) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _sources[key] = source;
+    }
+    void update(uint64_t key, Task_State &&state) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _sources.erase(key);
+        _states[key] = std::move(state);
+    }
+    void save() {
+        std::lock_guard<std::mutex> save_lock(_save_mtx);
+        std::map<uint64_t, Task_State> states;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            states = _states;
+            for (const auto &s: _sources) {
+                states[s.first] = s.second();
+            }
+        }
+        std::string temp = _filename + ".tmp";
+        {
+            Snapshot_Writer w(temp);
+            w.write(CHECKPOINT_MAGIC);
+            w.write(CHECKPOINT_VERSION);
+            w.write(_dict_key);
+            w.write(static_cast<uint64_t>(states.size()));
+            for (const auto &s: states) {
+                w.write(s.first);
+                write(w, s.second);
+            }
+            if (!w.ok()) {
+                std::cout << "Cannot save checkpoint " << temp << std::endl;
+                return;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, _filename, ec);
+        if (ec) {
+            std::cout << "Cannot save checkpoint " << _filename << std::endl;
+        }
+    }
+private:
+    void load() {
+        Snapshot_Reader r(_filename);
+        if (!r.ok()) {
+            return;
+        }
+        std::cout << "Loading checkpoint " << _filename << "...";
+        if ((r.read<uint64_t>() != CHECKPOINT_MAGIC) || (r.read<uint32_t>() != CHECKPOINT_VERSION)) {
+            std::cout << " Outdated" << std::endl;
+            return;
+        }
+        if (r.read<uint64_t>() != _dict_key) {
+            std::cout << " Saved with another dictionary" << std::endl;
+            return;
+        }
+        size_t count = r.read_size(MAX_TASKS);
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t key = r.read<uint64_t>();
+            read(r, _states[key]);
+        }
+        if (!r.ok()) {
+            std::cout << " Damaged" << std::endl;
+            _states.clear();
+            return;
+        }
+        std::cout << " Done (" << _states.size() << " tasks)" << std::endl;
+    }
+    static void write(Snapshot_Writer &w, const Task_State &state) {
+        w.write(state.finished);
+        w.write(state.iteration);
+        w.write(static_cast<uint64_t>(state.parts.size()));
+        for (const auto &p: state.parts) {
+            w.write(p.prefix);
+            w.write(static_cast<uint64_t>(p.path.size()));
+            w.write(p.path.data(), p.path.size() * sizeof(uint32_t));
+            w.write(p.lo);
+            w.write(p.hi);
+        }
+        w.write(static_cast<uint64_t>(state.solutions.size()));
+        for (const auto &s: state.solutions) {
+            w.write(s.first);
+            w.write(static_cast<uint64_t>(s.second.size()));
+            for (const auto &words: s.second) {
+                w.write(static_cast<uint64_t>(words.size()));
+                w.write(words.data(), words.size() * sizeof(Word));
+            }
+        }
+    }
+    static void read(Snapshot_Reader &r, Task_State &state) {
+        r.read(state.finished);
+        r.read(state.iteration);
+        state.parts.resize(r.read_size(MAX_ITEMS));
+        for (auto &p: state.parts) {
+            r.read(p.prefix);
+            p.path.resize(r.read_size(MAX_ITEMS));
+            r.read(p.path.data(), p.path.size() * sizeof(uint32_t));
+            r.read(p.lo);
+            r.read(p.hi);
+        }
+        size_t scores = r.read_size(MAX_ITEMS);
+        for (size_t i = 0; i < scores; ++i) {
+            auto &lists = state.solutions[r.read<score_t>()];
+            size_t count = r.read_size(MAX_ITEMS);
+            for (size_t j = 0; j < count; ++j) {
+                Word_List words(r.read_size(MAX_ITEMS), Word(0, 0, 0, 0));
+                r.read(words.data(), words.size() * sizeof(Word));
+                lists.insert(std::move(words));
+            }
+        }
+    }
+
+    static constexpr uint64_t MAX_TASKS = 1 << 20;
+    static constexpr uint64_t MAX_ITEMS = 1 << 24;
+
+    std::string             _filename;
+    uint64_t                _dict_key;
+    std::chrono::seconds    _interval;
+    std::map<uint64_t, Task_State>  _states;
+    std::map<uint64_t, Source>      _sources;
+    mutable std::mutex      _mtx;
+    std::mutex              _save_mtx;
+    std::mutex              _wait_mtx;
+    std::condition_variable _cv;
+    bool                    _stop;
+    std::thread             _thread;
+};
@@ -6,3 +6,7 @@ SET LDFLAGS=-O3 -static -s
 %CC% -c %CXXFLAGS% -I. main.cpp -o main.o
 
 %CC% -o playfair.exe main.o %LDFLAGS%
+
+%CC% -c %CXXFLAGS% -I. stats.cpp -o stats.o
+
+%CC% -o stats.exe stats.o %LDFLAGS%
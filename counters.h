@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+
+// Counters of the hot paths of the search, compiled in with -DPLAYFAIR_COUNTERS only, without it COUNT()
+// expands to nothing. A thread counts into the counters of the search it runs, so they need no locks;
+// the task merges the counters of its searches and prints them as one line of JSON
+class Counters {
+public:
+    static constexpr size_t MAX_DEPTH = 128;
+
+    // the counters the running search of the thread counts into
+    static Counters *&current() {
+        thread_local Counters *counters = nullptr;
+        return counters;
+    }
+    void merge(const Counters &that) {
+        push_accepted += that.push_accepted;
+        push_rejected += that.push_rejected;
+        filler_insertions += that.filler_insertions;
+        comma_branches += that.comma_branches;
+        clear_set_calls += that.clear_set_calls;
+        matrix_placements += that.matrix_placements;
+        for (size_t i = 0; i < MAX_DEPTH; ++i) {
+            rejected_by_depth[i] += that.rejected_by_depth[i];
+        }
+    }
+    void print_json(std::ostream &out, const std::string &matcher) const {
+        out << "{\"matcher\": \"" << matcher << "\"";
+        out << ", \"push_accepted\": " << push_accepted;
+        out << ", \"push_rejected\": " << push_rejected;
+        out << ", \"filler_insertions\": " << filler_insertions;
+        out << ", \"comma_branches\": " << comma_branches;
+        out << ", \"clear_set_calls\": " << clear_set_calls;
+        out << ", \"matrix_placements\": " << matrix_placements;
+        size_t depth = MAX_DEPTH;
+        while ((depth > 0) && (rejected_by_depth[depth - 1] == 0)) {
+            depth--;
+        }
+        out << ", \"rejected_by_depth\": [";
+        for (size_t i = 0; i < depth; ++i) {
+            out << ((i > 0) ? ", " : "") << rejected_by_depth[i];
+        }
+        out << "]}";
+    }
+
+    uint64_t    push_accepted = 0;
+    uint64_t    push_rejected = 0;
+    uint64_t    filler_insertions = 0;
+    uint64_t    comma_branches = 0;
+    uint64_t    clear_set_calls = 0;
+    uint64_t    matrix_placements = 0;
+    // the cleartext prefixes acceptable() has cut, by their length (the last one holds the longer ones)
+    std::array<uint64_t, MAX_DEPTH> rejected_by_depth{};
+};
+
+#ifdef PLAYFAIR_COUNTERS
+#define COUNT(name) (++Counters::current()->name)
+#define COUNT_AT(name, i) (++Counters::current()->name[std::min<size_t>((i), Counters::MAX_DEPTH - 1)])
+#else
+#define COUNT(name) ((void)0)
+#define COUNT_AT(name, i) ((void)0)
+#endif
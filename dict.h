@@ -38,6 +38,25 @@ std::string score_to_str(score_t s) {
     return std::to_string(s);
 }
 
+constexpr uint32_t ALL_SYMBOLS = (1 << 26) - 1;
+
+// trie symbols are lowercase latin letters, one bit each
+uint32_t symbol_bit(char ch) {
+    return ((ch >= 'a') && (ch <= 'z')) ? (1u << (ch - 'a')) : 0;
+}
+
+uint32_t bit_count(uint32_t v) {
+#ifdef __GNUC__
+    return static_cast<uint32_t>(__builtin_popcount(v));
+#else
+    uint32_t result = 0;
+    for (; v != 0; v &= v - 1) {
+        ++result;
+    }
+    return result;
+#endif
+}
+
 char to_lower(char ch) {
     return static_cast<char>(std::tolower(ch));
 }
@@ -94,7 +113,7 @@ private:
 
 using Word_List = std::vector<Word>;
 using Ticks = std::chrono::time_point<std::chrono::steady_clock>;
-using Word_Id_List = std::vector<std::pair<std::string, word_id>>;
+using Word_Id_List = std::vector<std::pair<std::string_view, word_id>>;
 
 using Word_Frequency_List = std::vector<std::pair<word_id, hits_t>>;
 using Word_Frequency_Map = std::map<word_id, hits_t>;
@@ -112,6 +131,29 @@ std::vector<std::pair<_T, hits_t>> sort_freq(const _C &v) {
     return result;
 }
 
+size_t hardware_threads() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// calls f(0) ... f(n - 1), indices are handed out one by one to keep uneven jobs balanced
+template <class _F>
+void parallel_for(size_t n, size_t threads, const _F &f) {
+    std::atomic<size_t> next(0);
+    auto func = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            f(i);
+        }
+    };
+    std::vector<std::future<void>> futures;
+    for (size_t i = 1; i < std::min(threads, n); ++i) {
+        futures.emplace_back(std::async(std::launch::async, func));
+    }
+    func();
+    for (auto &f: futures) {
+        f.get();
+    }
+}
+
 class Word_Id_Map {
 public:
     class Bimap {
@@ -142,6 +184,16 @@ public:
                 return it->second;
             }
         }
+        void save(Snapshot_Writer &w) const {
+            w.write(_id_to_word);
+        }
+        void load(Snapshot_Reader &r) {
+            r.read(_id_to_word);
+            _word_to_id.clear();
+            for (size_t i = 0; i < _id_to_word.size(); ++i) {
+                _word_to_id[_id_to_word[i]] = static_cast<word_id>(i);
+            }
+        }
     private:
         std::vector<std::string> _id_to_word;
         Map_Type<std::string, word_id> _word_to_id;
@@ -156,14 +208,27 @@ public:
         assert(comma == COMMA);
         assert(numeric == NUMERIC);
     }
-    std::set<std::string> &nproper() {
-        return _nproper;
-    }
-    std::set<std::string> &proper() {
-        return _proper;
-    }
-    std::set<std::string> &numeric() {
-        return _numeric;
+    // the vocabulary refers to the strings of the sets, they must not be copied
+    Word_Id_Map(const Word_Id_Map &) = delete;
+    Word_Id_Map(Word_Id_Map &&) = default;
+    Word_Id_Map &operator=(const Word_Id_Map &) = delete;
+    Word_Id_Map &operator=(Word_Id_Map &&) = default;
+    // Words which may get an id. A word found in several sets belongs to the first of numeric, proper, nproper
+    void set_vocabulary(std::set<std::string> &&nproper, std::set<std::string> &&proper, std::set<std::string> &&numeric) {
+        _nproper = std::move(nproper);
+        _proper = std::move(proper);
+        _numeric = std::move(numeric);
+        _vocabulary.clear();
+        _vocabulary.reserve(_nproper.size() + _proper.size() + _numeric.size());
+        for (const auto &w: _numeric) {
+            _vocabulary.emplace(w, Vocabulary_Entry{NUMERIC, NONE});
+        }
+        for (const auto &w: _proper) {
+            _vocabulary.emplace(w, Vocabulary_Entry{PROPER, NONE});
+        }
+        for (const auto &w: _nproper) {
+            _vocabulary.emplace(w, Vocabulary_Entry{NONE, NONE});
+        }
     }
     word_id add_proper(const std::string &s) {
         return _proper_start + _bimap_proper.add(s);
@@ -171,6 +236,7 @@ public:
     word_id add_numeric(const std::string &s) {
         return _numeric_start + _bimap_numeric.add(s);
     }
+    // one probe gives both the category and the id once it has been assigned
     word_id add(const std::string &s) {
         if (s == "$") {
             return COMMA;
@@ -178,18 +244,23 @@ public:
         else if (is_numeric(s)) {
             return NUMERIC;
         }
-        else if (_numeric.find(s) != _numeric.end()) {
-            return _numeric_start + _bimap_numeric.add(s);
-        }
-        else if (_proper.find(s) != _proper.end()) {
-            return _proper_start + _bimap_proper.add(s);
-        }
-        else if (_nproper.find(s) == _nproper.end()) {
+        auto it = _vocabulary.find(s);
+        if (it == _vocabulary.end()) {
             return NONE;
         }
-        else {
-            return _bimap_nproper.add(s);
+        Vocabulary_Entry &e = it->second;
+        if (e.id == NONE) {
+            if (e.category == NUMERIC) {
+                e.id = _numeric_start + _bimap_numeric.add(s);
+            }
+            else if (e.category == PROPER) {
+                e.id = _proper_start + _bimap_proper.add(s);
+            }
+            else {
+                e.id = _bimap_nproper.add(s);
+            }
         }
+        return e.id;
     }
     word_id category(word_id id) const {
         if (id >= _numeric_start) {
@@ -219,8 +290,29 @@ public:
     word_id id_by_word(const std::string &w) const {
         return _bimap_nproper.id_by_word(w);
     }
+    // the vocabulary is needed only while the dictionary is being built
+    void save(Snapshot_Writer &w) const {
+        _bimap_nproper.save(w);
+        _bimap_proper.save(w);
+        _bimap_numeric.save(w);
+        w.write(_proper_start);
+        w.write(_numeric_start);
+    }
+    void load(Snapshot_Reader &r) {
+        _bimap_nproper.load(r);
+        _bimap_proper.load(r);
+        _bimap_numeric.load(r);
+        r.read(_proper_start);
+        r.read(_numeric_start);
+    }
 private:
+    struct Vocabulary_Entry {
+        word_id     category;   // NUMERIC, PROPER or NONE for a non-proper word
+        word_id     id;         // NONE until add() meets the word
+    };
+
     std::set<std::string> _nproper, _proper, _numeric;
+    Map_Type<std::string_view, Vocabulary_Entry> _vocabulary;
     Bimap       _bimap_nproper;
     Bimap       _bimap_proper;
     Bimap       _bimap_numeric;
@@ -239,6 +331,8 @@ void print_list(const Word_Id_Map &word_id_map, const Word_Frequency_List &list,
     std::cout << std::endl;
 }
 
+class Frozen_Tree;
+
 class Prefix_Tree {
 public:
     static constexpr char EMPTY = ' ';
@@ -254,6 +348,10 @@ public:
     }
     Prefix_Tree &operator=(const Prefix_Tree &that) = delete;
     Prefix_Tree &operator=(Prefix_Tree &&that) noexcept {
+        if (this == &that) {
+            return *this;
+        }
+        delete [] _next_char;
         _word = that._word;
         _size = that._size;
         _symbol = that._symbol;
@@ -345,6 +443,35 @@ public:
             _size++;
         }
     }
+    void merge(Prefix_Tree &&that) {
+        if (that.is_word()) {
+            _word = that._word;
+        }
+        _hits += that._hits;
+        std::array<int32_t, 1 << 5> missing;
+        int32_t added = 0;
+        for(int32_t k = 0; k < that._size; ++k) {
+            Prefix_Tree *t = const_cast<Prefix_Tree *>(find_sub_tree(static_cast<char>(that._next_char[k]._symbol)));
+            if (t != nullptr) {
+                t->merge(std::move(that._next_char[k]));
+            }
+            else {
+                missing[static_cast<size_t>(added++)] = k;
+            }
+        }
+        if (added > 0) {
+            Prefix_Tree *w = new Prefix_Tree[_size + added];
+            for(int32_t i = 0; i < _size; ++i) {
+                w[i] = std::move(_next_char[i]);
+            }
+            for(int32_t i = 0; i < added; ++i) {
+                w[_size + i] = std::move(that._next_char[missing[static_cast<size_t>(i)]]);
+            }
+            delete [] _next_char;
+            _next_char = w;
+            _size = (_size + added) & ((1 << 5) - 1);
+        }
+    }
     std::pair<score_t, size_t> calc_scores(size_t l, size_t max_hits) {
         std::pair<score_t, size_t> result = {0, 0};
         if (is_word()) {
@@ -430,6 +557,40 @@ public:
         }
         return result;
     }
+    size_t node_count() const {
+        size_t result = 1;
+        for(int32_t i = 0; i < _size; ++i) {
+            result += _next_char[i].node_count();
+        }
+        return result;
+    }
+    // drops the words with less hits than min and the branches left without words,
+    // returns the hits of the most frequent word dropped
+    hits_t prune(hits_t min) {
+        hits_t result = 0;
+        if (is_word() && (_hits < min)) {
+            result = _hits;
+            _word = NONE;
+            _hits = 0;
+        }
+        int32_t n = 0;
+        for(int32_t i = 0; i < _size; ++i) {
+            result = std::max(result, _next_char[i].prune(min));
+            if (!_next_char[i].empty()) {
+                if (n != i) {
+                    _next_char[n] = std::move(_next_char[i]);
+                }
+                n++;
+            }
+        }
+        if (n == 0) {
+            delete [] _next_char;
+            _next_char = nullptr;
+        }
+        _size = n & ((1 << 5) - 1);
+        return result;
+    }
+    void freeze(Arena<Frozen_Tree> &arena, Frozen_Tree &node) const;
 private:
     void sort_chars() {
         std::sort(&(_next_char[0]), &(_next_char[_size]), [](const auto& a, const auto &b){
@@ -451,28 +612,234 @@ private:
     Prefix_Tree       *_next_char;
 };
 
+// Ranks of the words below a node of a frozen trie, words are ranked in depth-first order
+struct Word_Range {
+    uint32_t    lo;
+    uint32_t    hi;
+};
+
+// Part of the tree arena which holds the contexts of one depth (or their tries), in Frozen_Tree units.
+// Deeper contexts are reached by the search much less often
+struct Tree_Region {
+    uint32_t    begin;
+    uint32_t    end;
+    uint32_t    depth;
+};
+
+// Read-only copy of a scored Prefix_Tree. The nodes live in one arena in depth-first order,
+// children of a node are adjacent, sorted by symbol and addressed by 32-bit offset from the node itself.
+// The mask of child symbols gives the position of any child by popcount
+class Frozen_Tree {
+public:
+    bool is_root() const {
+        return (_symbol == Prefix_Tree::EMPTY);
+    }
+    bool is_word() const {
+        return (_word != NONE);
+    }
+    bool empty() const {
+        return !is_word() && (_size == 0);
+    }
+    word_id word() const {
+        return _word;
+    }
+    char symbol() const {
+        return static_cast<char>(_symbol);
+    }
+    score_t score() const {
+        return _primary._score;
+    }
+    score_t min_score() const {
+        return _primary._min_score;
+    }
+    size_t size() const {
+        return _size;
+    }
+    uint32_t mask() const {
+        return _mask;
+    }
+    const Frozen_Tree *find_sub_tree(char ch) const {
+        uint32_t b = symbol_bit(ch);
+        if ((_mask & b) == 0) {
+            return nullptr;
+        }
+        return next_char_begin() + bit_count(_mask & (b - 1));
+    }
+    const Frozen_Tree *next_char_begin() const {
+        return this + _next;
+    }
+    const Frozen_Tree *next_char_end() const {
+        return this + _next + _size;
+    }
+    const Frozen_Tree *find(const std::string_view &s) const {
+        if (s.empty()) {
+            return this;
+        }
+        const Frozen_Tree *t = find_sub_tree(s[0]);
+        return (t == nullptr) ? nullptr : t->find(s.substr(1));
+    }
+    void create_list(Word_Frequency_List &list) const {
+        if (is_word()) {
+            list.emplace_back(_word, 0);
+        }
+        for(auto r = next_char_begin(); r != next_char_end(); ++r) {
+            r->create_list(list);
+        }
+    }
+    Word_Frequency_List create_list() const {
+        Word_Frequency_List list;
+        create_list(list);
+        return list;
+    }
+    // fills the ranges of the whole trie, indexed by the position of a node in the arena
+    void rank_words(const Frozen_Tree *base, Word_Range *ranges, uint32_t &rank) const {
+        Word_Range &r = ranges[this - base];
+        r.lo = rank;
+        if (is_word()) {
+            rank++;
+        }
+        for(auto t = next_char_begin(); t != next_char_end(); ++t) {
+            t->rank_words(base, ranges, rank);
+        }
+        r.hi = rank;
+    }
+    // the rank of every word of the trie by its id, the ranges must be filled
+    template <class _Map>
+    void word_ranks(const Frozen_Tree *base, const Word_Range *ranges, _Map &ranks) const {
+        if (is_word()) {
+            ranks[_word] = ranges[this - base].lo;
+        }
+        for(auto t = next_char_begin(); t != next_char_end(); ++t) {
+            t->word_ranks(base, ranges, ranks);
+        }
+    }
+private:
+    friend class Prefix_Tree;
+    friend class Dictionary_View;
+
+    struct Score_Values {
+        small_score_t     _score;
+        small_score_t     _min_score;
+    };
+
+    uint32_t        _word:20;
+    uint32_t        _size:5;
+    uint32_t        _symbol:7;
+    Score_Values    _primary;
+    uint32_t        _next;
+    uint32_t        _mask;
+};
+
+// Word_Range of every node of the tries placed in one array
+class Word_Ranges {
+public:
+    Word_Ranges(const Frozen_Tree *base, const Word_Range *ranges): _base(base), _ranges(ranges) {
+    }
+    bool empty() const {
+        return (_ranges == nullptr);
+    }
+    const Word_Range &operator()(const Frozen_Tree &node) const {
+        return _ranges[&node - _base];
+    }
+private:
+    const Frozen_Tree   *_base;
+    const Word_Range    *_ranges;
+};
+
+void Prefix_Tree::freeze(Arena<Frozen_Tree> &arena, Frozen_Tree &node) const {
+    node._word = _word;
+    node._size = _size;
+    node._symbol = _symbol;
+    node._primary._score = _primary._score;
+    node._primary._min_score = _primary._min_score;
+    node._next = 0;
+    node._mask = 0;
+    if (_size > 0) {
+        Frozen_Tree *next = arena.alloc(_size);
+        node._next = static_cast<uint32_t>(next - &node);
+        for(int32_t i = 0; i < _size; ++i) {
+            assert(symbol_bit(static_cast<char>(_next_char[i]._symbol)) != 0);
+            assert((i == 0) || (_next_char[i - 1]._symbol < _next_char[i]._symbol));
+            node._mask |= symbol_bit(static_cast<char>(_next_char[i]._symbol));
+            _next_char[i].freeze(arena, next[i]);
+        }
+    }
+}
+
 class Word_Ngram_Tree_Map;
 
-class Word_Ngram_Tree {
+// Scores of the words which may follow a compact context, sorted by the rank of the word in the trie of the root
+// context. The context is followed along the root trie by narrowing the range of its records to the Word_Range
+// of the current node, the minimal score of the range comes from a segment tree.
+// The header is followed by the ranks and then by the segment tree, whose leaves are the scores
+class Word_Scores {
 public:
-    Word_Ngram_Tree();
-    Word_Ngram_Tree(const Word_Ngram_Tree &) = delete;
-    Word_Ngram_Tree(const Word_Ngram_Tree &&) = delete;
-    Word_Ngram_Tree &operator=(const Word_Ngram_Tree &&) = delete;
-    ~Word_Ngram_Tree();
-    void add(const Word_Id_Map &word_id_map, const Word_Id_List &words, hits_t h, bool tail_original);
-    const Word_Ngram_Tree *find() const {
+    size_t size() const {
+        return _size;
+    }
+    const uint32_t *ranks() const {
+        return reinterpret_cast<const uint32_t *>(this + 1);
+    }
+    score_t score(size_t i) const {
+        return mins()[_size + i];
+    }
+    score_t min_score(size_t begin, size_t end) const {
+        const small_score_t *m = mins();
+        small_score_t result = INF_SCORE;
+        for (begin += _size, end += _size; begin < end; begin /= 2, end /= 2) {
+            if (begin % 2 == 1) {
+                result = std::min(result, m[begin++]);
+            }
+            if (end % 2 == 1) {
+                result = std::min(result, m[--end]);
+            }
+        }
+        return result;
+    }
+    std::pair<size_t, size_t> narrow(size_t begin, size_t end, const Word_Range &range) const {
+        const uint32_t *b = std::lower_bound(ranks() + begin, ranks() + end, range.lo);
+        const uint32_t *e = std::lower_bound(b, ranks() + end, range.hi);
+        return {static_cast<size_t>(b - ranks()), static_cast<size_t>(e - ranks())};
+    }
+    static size_t bytes(size_t n) {
+        return sizeof(Word_Scores) + n * (sizeof(uint32_t) + 2 * sizeof(small_score_t));
+    }
+private:
+    friend class Word_Ngram_Tree;
+
+    uint32_t *ranks() {
+        return reinterpret_cast<uint32_t *>(this + 1);
+    }
+    const small_score_t *mins() const {
+        return reinterpret_cast<const small_score_t *>(ranks() + _size);
+    }
+    small_score_t *mins() {
+        return reinterpret_cast<small_score_t *>(ranks() + _size);
+    }
+
+    uint32_t    _size;
+    uint32_t    _reserved[3];
+};
+
+static_assert(sizeof(Word_Scores) == sizeof(Frozen_Tree), "Word_Scores header must take one node");
+
+// Read-only copy of a scored Word_Ngram_Tree. The contexts are placed in the tree arena after all the tries
+// in breadth-first order, so the contexts of one order are adjacent. Children of a context are adjacent too
+// and sorted by word id, the following word is found by binary search.
+// A compact context has no trie of its own, but Word_Scores keyed by the trie of the root context.
+// The links are offsets, the arena can be saved and loaded as is
+class Frozen_Ngram_Tree {
+public:
+    const Frozen_Ngram_Tree *find() const {
         return this;
     }
     template <class... _Id>
-    const Word_Ngram_Tree *find(word_id id, _Id... ids) const {
-        const Word_Ngram_Tree *w =_find(id);
+    const Frozen_Ngram_Tree *find(word_id id, _Id... ids) const {
+        const Frozen_Ngram_Tree *w =_find(id);
         return (w == nullptr) ? nullptr : w->find(ids...);
     }
-    std::pair<score_t, size_t> calc_scores(bool use_max);
-    void adjust_scores(small_score_t add, small_score_t add_delta, small_score_t nom, small_score_t denom, small_score_t min = std::numeric_limits<small_score_t>::min());
     size_t total() const {
-        return _total;
+        return static_cast<size_t>(_total);
     }
     score_t other() const {
         return _other;
@@ -495,14 +862,24 @@ public:
     hits_t comma_hits() const {
         return _comma_hits;
     }
-    const Prefix_Tree &tree() const {
-        return _tree;
+    bool has_tree() const {
+        return (_tree != 0);
+    }
+    const Frozen_Tree &tree() const {
+        assert(has_tree());
+        return *(reinterpret_cast<const Frozen_Tree *>(this) - _tree);
     }
-    Prefix_Tree &tree() {
-        return _tree;
+    const Word_Scores *scores() const {
+        return (_scores == 0) ? nullptr : reinterpret_cast<const Word_Scores *>(reinterpret_cast<const Frozen_Tree *>(this) + _scores);
+    }
+    const Frozen_Ngram_Tree *next_begin() const {
+        return this + _next;
+    }
+    const Frozen_Ngram_Tree *next_end() const {
+        return this + _next + _size;
     }
     Word_Frequency_List create_list() const {
-        Word_Frequency_List list = _tree.create_list();
+        Word_Frequency_List list = tree().create_list();
         if (_proper_hits > 0) {
             list.emplace_back(PROPER, _proper_hits);
         }
@@ -520,14 +897,98 @@ public:
         print_list(word_id_map, list, max);
     }
 private:
-    void _add(const Word_Id_Map &word_id_map, const Word_Id_List &words, size_t n, hits_t h, bool tail_original);
-    const Word_Ngram_Tree *_find(word_id id) const;
+    friend class Word_Ngram_Tree;
+
+    const Frozen_Ngram_Tree *_find(word_id id) const {
+        auto it = std::lower_bound(next_begin(), next_end(), id, [](const Frozen_Ngram_Tree &t, word_id id) {
+            return t._key < id;
+        });
+        return ((it != next_end()) && (it->_key == id)) ? it : nullptr;
+    }
+
+    uint64_t        _total;
+    word_id         _key;
+    uint32_t        _tree;      // distance back to the root of the trie, in Frozen_Tree units
+    uint32_t        _scores;    // distance forward to Word_Scores of a compact context, in Frozen_Tree units
+    uint32_t        _next;
+    uint32_t        _size;
+    hits_t          _proper_hits;
+    hits_t          _numeric_hits;
+    hits_t          _comma_hits;
+    small_score_t   _proper_score;
+    small_score_t   _numeric_score;
+    small_score_t   _comma_score;
+    small_score_t   _other;
+};
+
+// the children arrays of contexts must stay aligned to each other
+static_assert(sizeof(Frozen_Ngram_Tree) % sizeof(Frozen_Tree) == 0, "Frozen_Ngram_Tree must take whole nodes");
+
+class Word_Ngram_Tree {
+public:
+    Word_Ngram_Tree();
+    Word_Ngram_Tree(const Word_Ngram_Tree &) = delete;
+    Word_Ngram_Tree(const Word_Ngram_Tree &&) = delete;
+    Word_Ngram_Tree &operator=(const Word_Ngram_Tree &&) = delete;
+    ~Word_Ngram_Tree();
+    // in the compact mode the contexts which get no trie keep their words as records, their tries are never spelled
+    void add(const Word_Id_Map &word_id_map, const Word_Id_List &words, hits_t h, bool tail_original, bool compact);
+    std::pair<score_t, size_t> calc_scores(bool use_max);
+    std::pair<score_t, size_t> calc_scores(bool use_max, size_t threads);
+    void merge(Word_Ngram_Tree &that);
+    void adjust_scores(small_score_t add, small_score_t add_delta, small_score_t nom, small_score_t denom, small_score_t min = std::numeric_limits<small_score_t>::min());
+    size_t total() const {
+        return _total;
+    }
+    score_t other() const {
+        return _other;
+    }
+    void clear();
+    // Drops the followers of a context with less than min_hits hits or out of its top_k (0 for no limit,
+    // ties with the last one are kept) and the contexts left empty. A dropped follower scores as another word,
+    // whose score goes down to the score of the most frequent follower dropped, the total stays the same.
+    // The root context is the vocabulary and the comma context starts the odd mode, they stay whole
+    void prune(hits_t min_hits, size_t top_k);
+    size_t node_count() const;
+    size_t context_count() const;
+    // moves the scored tries of all contexts into the arena and releases them
+    // in the compact mode only the root context and the comma context of the first level keep their tries
+    // every freeze_*() adds the regions it has allocated, one per depth
+    void freeze_trees(Arena<Frozen_Tree> &arena, bool compact, std::vector<Tree_Region> &regions);
+    void rank_words(const Frozen_Tree *base, Word_Range *ranges) const;
+    // must go after freeze_trees() of every tree sharing the arena
+    Frozen_Ngram_Tree *freeze_contexts(Arena<Frozen_Tree> &arena, std::vector<Tree_Region> &regions) const;
+    // Word_Scores of the contexts without tries, must go after freeze_contexts() of every tree sharing the arena
+    void freeze_scores(Arena<Frozen_Tree> &arena, Frozen_Ngram_Tree *root, const Word_Range *ranges, std::vector<Tree_Region> &regions) const;
+private:
+    // a word of a context without a trie: its hits until the scores are calculated, its score after that
+    struct Word_Hits {
+        word_id     word;
+        union {
+            hits_t          hits;
+            small_score_t   score;
+        };
+    };
+
+    // only the root context and the comma context of the first level keep their tries in the compact mode
+    static bool has_trie(bool compact, size_t depth, word_id key) {
+        return !compact || (depth == 0) || ((depth == 1) && (key == COMMA));
+    }
+    void _add(const Word_Id_Map &word_id_map, const Word_Id_List &words, size_t n, hits_t h, bool tail_original, bool compact, size_t depth, word_id key);
+    bool _prune(hits_t min_hits, size_t top_k, size_t depth, word_id key);
+    std::vector<std::pair<word_id, Word_Ngram_Tree *>> sorted_next() const;
+    std::pair<score_t, size_t> calc_own_scores(bool use_max);
+    void add_word(word_id id, hits_t h);
+    void merge_words();
     Word_Ngram_Tree_Map *_next;
     Prefix_Tree     _tree;
+    std::unique_ptr<std::vector<Word_Hits>> _words;    // nullptr unless there are records
+    const Frozen_Tree   *_frozen;
     size_t          _total;
     hits_t          _proper_hits;
     hits_t          _numeric_hits;
     hits_t          _comma_hits;
+    hits_t          _pruned_hits;
     small_score_t   _proper_score;
     small_score_t   _numeric_score;
     small_score_t   _comma_score;
@@ -538,7 +999,7 @@ class Word_Ngram_Tree_Map: public Map_Type<word_id, Word_Ngram_Tree> {
 };
 
 Word_Ngram_Tree::Word_Ngram_Tree(): _next(nullptr),
-_tree(), _total(0), _proper_hits(0), _numeric_hits(0), _comma_hits(0),
+_tree(), _words(), _frozen(nullptr), _total(0), _proper_hits(0), _numeric_hits(0), _comma_hits(0), _pruned_hits(0),
 _proper_score(0), _numeric_score(0), _comma_score(0), _other(0) {
 }
 
@@ -547,26 +1008,101 @@ Word_Ngram_Tree::~Word_Ngram_Tree() {
 }
 
 std::pair<score_t, size_t> Word_Ngram_Tree::calc_scores(bool use_max) {
-    size_t mh = _tree.empty() ? 0 : (use_max ? _tree.max_hits() : _total);
+    auto result = calc_own_scores(use_max);
+    if (_next != nullptr) {
+        for (auto &t: *_next) {
+            auto q = t.second.calc_scores(use_max);
+            result.first += q.first;
+            result.second += q.second;
+        }
+    }
+    return result;
+}
+
+// the same as calc_scores(use_max), but the contexts of the first level are spread among threads
+std::pair<score_t, size_t> Word_Ngram_Tree::calc_scores(bool use_max, size_t threads) {
+    auto result = calc_own_scores(use_max);
+    if (_next != nullptr) {
+        std::vector<Word_Ngram_Tree *> list;
+        list.reserve(_next->size());
+        for (auto &t: *_next) {
+            list.push_back(&t.second);
+        }
+        std::vector<std::pair<score_t, size_t>> sums(list.size());
+        parallel_for(list.size(), threads, [&](size_t i) {
+            sums[i] = list[i]->calc_scores(use_max);
+        });
+        for (const auto &q: sums) {
+            result.first += q.first;
+            result.second += q.second;
+        }
+    }
+    return result;
+}
+
+void Word_Ngram_Tree::merge(Word_Ngram_Tree &that) {
+    _total += that._total;
+    _proper_hits += that._proper_hits;
+    _numeric_hits += that._numeric_hits;
+    _comma_hits += that._comma_hits;
+    _tree.merge(std::move(that._tree));
+    if (that._words != nullptr) {
+        if (_words == nullptr) {
+            std::swap(_words, that._words);
+        }
+        else {
+            _words->insert(_words->end(), that._words->begin(), that._words->end());
+            that._words.reset();
+            merge_words();
+        }
+    }
+    if (that._next == nullptr) {
+        return;
+    }
+    if (_next == nullptr) {
+        std::swap(_next, that._next);
+        return;
+    }
+    for (auto &t: *that._next) {
+        (*_next)[t.first].merge(t.second);
+    }
+    that.clear();
+}
+
+std::pair<score_t, size_t> Word_Ngram_Tree::calc_own_scores(bool use_max) {
+    merge_words();
+    size_t mh = 0;
+    if (!_tree.empty() || (_words != nullptr) || (_pruned_hits > 0)) {
+        hits_t max_hits = _tree.empty() ? 0 : _tree.max_hits();
+        if (_words != nullptr) {
+            for (const auto &w: *_words) {
+                max_hits = std::max(max_hits, w.hits);
+            }
+        }
+        mh = use_max ? std::max(max_hits, _pruned_hits) : _total;
+    }
     mh = std::max(mh, static_cast<size_t>(_proper_hits));
     mh = std::max(mh, static_cast<size_t>(_numeric_hits));
     mh = std::max(mh, static_cast<size_t>(_comma_hits));
-    _other = calc_score(0, mh);
+    _other = calc_score(_pruned_hits, mh);
     _proper_score = calc_score(_proper_hits, mh);
     _numeric_score = calc_score(_numeric_hits, mh);
     _comma_score = calc_score(_comma_hits, mh);
-    auto result = _tree.calc_scores(0, mh);
-    if (_next != nullptr) {
-        for (auto &t: *_next) {
-            auto q = t.second.calc_scores(use_max);
-            result.first += q.first;
-            result.second += q.second;
+    std::pair<score_t, size_t> result = _tree.calc_scores(0, mh);
+    // a record has no spelling, it adds no chars to the sum
+    if (_words != nullptr) {
+        for (auto &w: *_words) {
+            hits_t hits = w.hits;
+            w.score = calc_score(hits, mh);
+            result.first += static_cast<score_t>(hits) * w.score;
         }
     }
     return result;
 }
 
 void Word_Ngram_Tree::adjust_scores(small_score_t add, small_score_t add_delta, small_score_t nom, small_score_t denom, small_score_t min) {
+    // the length of a record is not known, only the spelled tries are adjusted
+    assert(_words == nullptr);
     _tree.adjust_scores(add, add_delta, nom, denom, min);
     if (_next != nullptr) {
         for (auto &t: *_next) {
@@ -575,21 +1111,21 @@ void Word_Ngram_Tree::adjust_scores(small_score_t add, small_score_t add_delta,
     }
 }
 
-void Word_Ngram_Tree::add(const Word_Id_Map &word_id_map, const Word_Id_List &words, hits_t h, bool tail_original) {
+void Word_Ngram_Tree::add(const Word_Id_Map &word_id_map, const Word_Id_List &words, hits_t h, bool tail_original, bool compact) {
     if (words.size() == 0) {
         return;
     }
-    _add(word_id_map, words, words.size() - 1, h, tail_original);
+    _add(word_id_map, words, words.size() - 1, h, tail_original, compact, 0, NONE);
 }
 
-void Word_Ngram_Tree::_add(const Word_Id_Map &word_id_map, const Word_Id_List &words, size_t n, hits_t h, bool tail_original) {
+void Word_Ngram_Tree::_add(const Word_Id_Map &word_id_map, const Word_Id_List &words, size_t n, hits_t h, bool tail_original, bool compact, size_t depth, word_id key) {
     if (n > 0) {
         if (words[n - 1].second != NONE) {
             word_id id = word_id_map.category(words[n - 1].second);
             if (_next == nullptr) {
                 _next = new Word_Ngram_Tree_Map();
             }
-            (*_next)[id]._add(word_id_map, words, n - 1, h, tail_original);
+            (*_next)[id]._add(word_id_map, words, n - 1, h, tail_original, compact, depth + 1, id);
         }
     }
     else if (words.back().second != NONE) {
@@ -604,25 +1140,286 @@ void Word_Ngram_Tree::_add(const Word_Id_Map &word_id_map, const Word_Id_List &w
         else if (id == COMMA) {
             _comma_hits += h;
         }
-        else {
+        else if (has_trie(compact, depth, key)) {
             _tree.add_hits(words.back().first, id, h);
         }
+        else {
+            add_word(id, h);
+        }
     }
 }
 
-const Word_Ngram_Tree *Word_Ngram_Tree::_find(word_id id) const {
-    if (_next == nullptr) {
-        return nullptr;
+// the records are merged when their vector is full, so a word met many times takes about one record
+void Word_Ngram_Tree::add_word(word_id id, hits_t h) {
+    if (_words == nullptr) {
+        _words = std::make_unique<std::vector<Word_Hits>>();
     }
-    auto it = _next->find(id);
-    return (it == _next->end()) ? nullptr : &(it->second);
+    else if (_words->size() == _words->capacity()) {
+        merge_words();
+    }
+    Word_Hits w;
+    w.word = id;
+    w.hits = h;
+    _words->push_back(w);
 }
 
-bool test_word(const std::string &s) {
-    for (auto ch: s) {
-        bool l = (ch >= 'a') && (ch <= 'z');
-        bool u = (ch >= 'A') && (ch <= 'Z');
-        if (!l && !u) {
+// sorts the records by word and joins the records of one word
+void Word_Ngram_Tree::merge_words() {
+    if (_words == nullptr) {
+        return;
+    }
+    std::vector<Word_Hits> &words = *_words;
+    std::sort(words.begin(), words.end(), [](const Word_Hits &a, const Word_Hits &b) {
+        return a.word < b.word;
+    });
+    size_t n = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        if ((n > 0) && (words[n - 1].word == words[i].word)) {
+            words[n - 1].hits += words[i].hits;
+        }
+        else {
+            words[n++] = words[i];
+        }
+    }
+    words.resize(n);
+}
+
+void Word_Ngram_Tree::clear() {
+    delete _next;
+    _next = nullptr;
+    _tree = Prefix_Tree();
+    _words.reset();
+    _frozen = nullptr;
+    _total = 0;
+    _proper_hits = _numeric_hits = _comma_hits = _pruned_hits = 0;
+    _proper_score = _numeric_score = _comma_score = _other = 0;
+}
+
+void Word_Ngram_Tree::prune(hits_t min_hits, size_t top_k) {
+    _prune(min_hits, top_k, 0, NONE);
+}
+
+// true if nothing is left in the context
+bool Word_Ngram_Tree::_prune(hits_t min_hits, size_t top_k, size_t depth, word_id key) {
+    if (_next != nullptr) {
+        for (auto it = _next->begin(); it != _next->end();) {
+            if (it->second._prune(min_hits, top_k, depth + 1, it->first)) {
+                it = _next->erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if (_next->empty()) {
+            delete _next;
+            _next = nullptr;
+        }
+    }
+    if ((depth > 1) || ((depth == 1) && (key != COMMA))) {
+        merge_words();
+        hits_t min = min_hits;
+        if (top_k > 0) {
+            Word_Frequency_List list = _tree.create_list();
+            if (_words != nullptr) {
+                for (const auto &w: *_words) {
+                    list.emplace_back(w.word, w.hits);
+                }
+            }
+            if (list.size() > top_k) {
+                std::nth_element(list.begin(), list.begin() + static_cast<ptrdiff_t>(top_k - 1), list.end(), [](const auto &a, const auto &b) {
+                    return a.second > b.second;
+                });
+                min = std::max(min, list[top_k - 1].second);
+            }
+        }
+        _pruned_hits = std::max(_pruned_hits, _tree.prune(min));
+        if (_words != nullptr) {
+            std::vector<Word_Hits> &words = *_words;
+            size_t n = 0;
+            for (size_t i = 0; i < words.size(); ++i) {
+                if (words[i].hits < min) {
+                    _pruned_hits = std::max(_pruned_hits, words[i].hits);
+                }
+                else {
+                    words[n++] = words[i];
+                }
+            }
+            words.resize(n);
+            words.shrink_to_fit();
+            if (words.empty()) {
+                _words.reset();
+            }
+        }
+    }
+    return _tree.empty() && (_words == nullptr) && (_next == nullptr) && (_proper_hits == 0) && (_numeric_hits == 0) && (_comma_hits == 0);
+}
+
+// a record counts as a node, it takes less than a node in Word_Scores too
+size_t Word_Ngram_Tree::node_count() const {
+    size_t result = _tree.node_count() + ((_words != nullptr) ? _words->size() : 0);
+    if (_next != nullptr) {
+        for (const auto &t: *_next) {
+            result += t.second.node_count();
+        }
+    }
+    return result;
+}
+
+size_t Word_Ngram_Tree::context_count() const {
+    size_t result = 1;
+    if (_next != nullptr) {
+        for (const auto &t: *_next) {
+            result += t.second.context_count();
+        }
+    }
+    return result;
+}
+
+std::vector<std::pair<word_id, Word_Ngram_Tree *>> Word_Ngram_Tree::sorted_next() const {
+    std::vector<std::pair<word_id, Word_Ngram_Tree *>> result;
+    if (_next != nullptr) {
+        result.reserve(_next->size());
+        for (auto &t: *_next) {
+            result.emplace_back(t.first, &t.second);
+        }
+        std::sort(result.begin(), result.end());
+    }
+    return result;
+}
+
+void add_region(std::vector<Tree_Region> &regions, size_t begin, size_t end, size_t depth) {
+    assert(end <= std::numeric_limits<uint32_t>::max());
+    if (begin < end) {
+        regions.push_back({static_cast<uint32_t>(begin), static_cast<uint32_t>(end), static_cast<uint32_t>(depth)});
+    }
+}
+
+// the tries are laid out in the same breadth-first order as the contexts
+void Word_Ngram_Tree::freeze_trees(Arena<Frozen_Tree> &arena, bool compact, std::vector<Tree_Region> &regions) {
+    // the odd mode starts the search right from the trie of the comma context
+    std::vector<std::pair<word_id, Word_Ngram_Tree *>> level = {{NONE, this}};
+    for (size_t depth = 0; !level.empty(); ++depth) {
+        std::vector<std::pair<word_id, Word_Ngram_Tree *>> next;
+        size_t begin = arena.size();
+        for (const auto &p: level) {
+            Word_Ngram_Tree *t = p.second;
+            if (has_trie(compact, depth, p.first)) {
+                Frozen_Tree *root = arena.alloc(1);
+                t->_tree.freeze(arena, *root);
+                t->_tree = Prefix_Tree();
+                t->_frozen = root;
+            }
+            for (const auto &c: t->sorted_next()) {
+                next.push_back(c);
+            }
+        }
+        add_region(regions, begin, arena.size(), depth);
+        level.swap(next);
+    }
+}
+
+void Word_Ngram_Tree::rank_words(const Frozen_Tree *base, Word_Range *ranges) const {
+    uint32_t rank = 0;
+    _frozen->rank_words(base, ranges, rank);
+}
+
+Frozen_Ngram_Tree *Word_Ngram_Tree::freeze_contexts(Arena<Frozen_Tree> &arena, std::vector<Tree_Region> &regions) const {
+    size_t begin = arena.size();
+    Frozen_Ngram_Tree *root = arena.alloc_as<Frozen_Ngram_Tree>(1);
+    root->_key = NONE;
+    add_region(regions, begin, arena.size(), 0);
+    std::vector<std::pair<const Word_Ngram_Tree *, Frozen_Ngram_Tree *>> level = {{this, root}};
+    for (size_t depth = 0; !level.empty(); ++depth) {
+        std::vector<std::pair<const Word_Ngram_Tree *, Frozen_Ngram_Tree *>> next;
+        // the children of this level are the contexts of the next depth
+        begin = arena.size();
+        for (const auto &p: level) {
+            const Word_Ngram_Tree &t = *p.first;
+            Frozen_Ngram_Tree &node = *p.second;
+            size_t back = (t._frozen == nullptr) ? 0 : static_cast<size_t>(reinterpret_cast<const Frozen_Tree *>(&node) - t._frozen);
+            assert(back <= std::numeric_limits<uint32_t>::max());
+            node._total = t._total;
+            node._tree = static_cast<uint32_t>(back);
+            node._scores = 0;
+            node._proper_hits = t._proper_hits;
+            node._numeric_hits = t._numeric_hits;
+            node._comma_hits = t._comma_hits;
+            node._proper_score = t._proper_score;
+            node._numeric_score = t._numeric_score;
+            node._comma_score = t._comma_score;
+            node._other = t._other;
+            auto list = t.sorted_next();
+            Frozen_Ngram_Tree *children = arena.alloc_as<Frozen_Ngram_Tree>(list.size());
+            node._next = static_cast<uint32_t>(children - &node);
+            node._size = static_cast<uint32_t>(list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                children[i]._key = list[i].first;
+                next.emplace_back(list[i].second, &children[i]);
+            }
+        }
+        add_region(regions, begin, arena.size(), depth + 1);
+        level.swap(next);
+    }
+    return root;
+}
+
+void Word_Ngram_Tree::freeze_scores(Arena<Frozen_Tree> &arena, Frozen_Ngram_Tree *root, const Word_Range *ranges, std::vector<Tree_Region> &regions) const {
+    const Frozen_Tree *base = arena.data();
+    Map_Type<word_id, uint32_t> ranks;
+    _frozen->word_ranks(base, ranges, ranks);
+    std::vector<std::pair<const Word_Ngram_Tree *, Frozen_Ngram_Tree *>> level = {{this, root}};
+    std::vector<std::pair<uint32_t, small_score_t>> words;
+    for (size_t depth = 0; !level.empty(); ++depth) {
+        std::vector<std::pair<const Word_Ngram_Tree *, Frozen_Ngram_Tree *>> next;
+        size_t begin = arena.size();
+        for (const auto &p: level) {
+            const Word_Ngram_Tree &t = *p.first;
+            Frozen_Ngram_Tree &node = *p.second;
+            if (t._frozen == nullptr) {
+                // words missing in the root trie can never be reached by the search
+                words.clear();
+                if (t._words != nullptr) {
+                    for (const auto &w: *t._words) {
+                        auto it = ranks.find(w.word);
+                        if (it != ranks.end()) {
+                            words.emplace_back(it->second, w.score);
+                        }
+                    }
+                }
+                if (!words.empty()) {
+                    std::sort(words.begin(), words.end());
+                    size_t n = words.size();
+                    Word_Scores *ws = reinterpret_cast<Word_Scores *>(arena.alloc_as<uint8_t>(Word_Scores::bytes(n)));
+                    ws->_size = static_cast<uint32_t>(n);
+                    uint32_t *ranks = ws->ranks();
+                    small_score_t *mins = ws->mins();
+                    for (size_t i = 0; i < n; ++i) {
+                        ranks[i] = words[i].first;
+                        mins[n + i] = words[i].second;
+                    }
+                    mins[0] = INF_SCORE;
+                    for (size_t i = n - 1; i > 0; --i) {
+                        mins[i] = std::min(mins[2 * i], mins[2 * i + 1]);
+                    }
+                    node._scores = static_cast<uint32_t>(reinterpret_cast<const Frozen_Tree *>(ws) - reinterpret_cast<const Frozen_Tree *>(&node));
+                }
+            }
+            auto list = t.sorted_next();
+            Frozen_Ngram_Tree *children = node._size > 0 ? const_cast<Frozen_Ngram_Tree *>(node.next_begin()) : nullptr;
+            for (size_t i = 0; i < list.size(); ++i) {
+                next.emplace_back(list[i].second, &children[i]);
+            }
+        }
+        add_region(regions, begin, arena.size(), depth);
+        level.swap(next);
+    }
+}
+
+bool test_word(const std::string &s) {
+    for (auto ch: s) {
+        bool l = (ch >= 'a') && (ch <= 'z');
+        bool u = (ch >= 'A') && (ch <= 'Z');
+        if (!l && !u) {
             return false;
         }
     }
@@ -631,6 +1428,9 @@ bool test_word(const std::string &s) {
 
 class Common_Converter {
 public:
+    static std::string name() {
+        return "common";
+    }
     std::string operator()(std::string s) const {
         return s;
     }
@@ -639,6 +1439,9 @@ public:
 
 class Converter_JI {
 public:
+    static std::string name() {
+        return "ji";
+    }
     std::string operator()(std::string s) const {
         for (auto &ch: s) {
             if (ch == 'j') {
@@ -719,24 +1522,24 @@ public:
         print_words(ids...);
     }
 
-    const Word_Ngram_Tree *find_tree(const Word_Ngram_Tree &source) const {
+    const Frozen_Ngram_Tree *find_tree(const Frozen_Ngram_Tree &source) const {
         return &source;
     }
     template <class... _Id>
-    const Word_Ngram_Tree *find_tree(const Word_Ngram_Tree &source, word_id id, _Id...ids) const {
-        const Word_Ngram_Tree *w = find_tree(source, ids...);
+    const Frozen_Ngram_Tree *find_tree(const Frozen_Ngram_Tree &source, word_id id, _Id...ids) const {
+        const Frozen_Ngram_Tree *w = find_tree(source, ids...);
         return (w != nullptr) ? w->find(id) : nullptr;
     }
     template <class... _Id>
-    const Word_Ngram_Tree *find_tree(const Word_Ngram_Tree &source, const std::string &word, _Id...ids) const {
+    const Frozen_Ngram_Tree *find_tree(const Frozen_Ngram_Tree &source, const std::string &word, _Id...ids) const {
         return find_tree(source, word_id_map().id_by_word(word), ids...);
     }
 
     template <class... _Id>
-    score_t _test_next_word(const Word_Ngram_Tree &source, const std::string &next_word, score_t other, _Id...ids) const {
-        const Word_Ngram_Tree *w = find_tree(source, ids...);
+    score_t _test_next_word(const Frozen_Ngram_Tree &source, const std::string &next_word, score_t other, _Id...ids) const {
+        const Frozen_Ngram_Tree *w = find_tree(source, ids...);
         if (w != nullptr) {
-            const Prefix_Tree *t = w->tree().find(next_word);
+            const Frozen_Tree *t = w->tree().find(next_word);
             if ((t != nullptr) && t->is_word()) {
                 print_words(ids...);
                 std::cout << "-> " << next_word << " (" << t->score();
@@ -755,22 +1558,55 @@ public:
         }
         return other;
     }
-    void test_next_word(const Word_Ngram_Tree &source, const std::string &next_word, score_t other) const {
+    void test_next_word(const Frozen_Ngram_Tree &source, const std::string &next_word, score_t other) const {
        _test_next_word(source, next_word, other);
     }
     template <class... _Id>
-    void test_next_word(const Word_Ngram_Tree &source, const std::string &next_word, score_t other, word_id id, _Id...ids) const {
+    void test_next_word(const Frozen_Ngram_Tree &source, const std::string &next_word, score_t other, word_id id, _Id...ids) const {
         score_t o = _test_next_word(source, next_word, other, id, ids...);
         test_next_word(source, next_word, o, ids...);
     }
 
     template <class... _Id>
-    void test_next_word(const Word_Ngram_Tree &source, const std::string &next_word, score_t other, const std::string &word, _Id...ids) const {
+    void test_next_word(const Frozen_Ngram_Tree &source, const std::string &next_word, score_t other, const std::string &word, _Id...ids) const {
         test_next_word(source, next_word, other, word_id_map().id_by_word(word), ids...);
     }
 
     template <class _Conv>
-    Dictionary(const _Conv &conv, const std::vector<std::string> &stat_files, const std::vector<std::string> &nprop_files, const std::vector<std::string> &prop_files, const std::vector<std::string> &numeric_files, size_t max_word_count) {
+    Dictionary(const _Conv &conv, const std::vector<std::string> &stat_files, const std::vector<std::string> &nprop_files, const std::vector<std::string> &prop_files, const std::vector<std::string> &numeric_files, size_t max_word_count, bool compact, hits_t min_hits, size_t top_k, const std::string &cache_dir) {
+        _letters = cleartext_letters(conv);
+        if (cache_dir.empty()) {
+            _ok = build(conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count, compact, min_hits, top_k);
+            return;
+        }
+        std::string snapshot = snapshot_filename(cache_dir, conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count, compact, min_hits, top_k);
+        if (load_snapshot(snapshot)) {
+            return;
+        }
+        // processes started together build the snapshot once, the others wait and load it
+        std::error_code ec;
+        std::filesystem::create_directories(cache_dir, ec);
+        Snapshot_Lock lock(snapshot + ".lock");
+        if (load_snapshot(snapshot)) {
+            return;
+        }
+        // a dictionary built from a broken stat file is not cached
+        _ok = build(conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count, compact, min_hits, top_k);
+        if (_ok) {
+            save_snapshot(snapshot);
+        }
+    }
+    // false when a stat file could not be read, the dictionary must not be used then
+    bool ok() const {
+        return _ok;
+    }
+    // the letters a cleartext is made of, the most frequent first
+    const std::string &letters() const {
+        return _letters;
+    }
+
+    template <class _Conv>
+    bool build(const _Conv &conv, const std::vector<std::string> &stat_files, const std::vector<std::string> &nprop_files, const std::vector<std::string> &prop_files, const std::vector<std::string> &numeric_files, size_t max_word_count, bool compact, hits_t min_hits, size_t top_k) {
         std::set<std::string> nproper, proper, numeric;
         for(const auto &fn: nprop_files) {
             std::cout << "Loading protected non-proper name file " << fn << "...";
@@ -790,45 +1626,137 @@ public:
             std::cout << " Done" << std::endl;
         }
 
-        auto p = load_stats_words(stat_files, max_word_count, conv, nproper, numeric);
-        _word_id_map.nproper() = std::move(p.first);
-        _word_id_map.proper() = std::move(p.second);
-        _word_id_map.numeric() = std::move(numeric);
+        size_t threads = hardware_threads();
+        std::vector<std::unique_ptr<Stat_Chunk>> chunks;
+        for(const auto &fn: stat_files) {
+            std::error_code ec;
+            uint64_t size = std::filesystem::file_size(fn, ec);
+            size_t parts = ec ? 1 : std::min<size_t>(threads, static_cast<size_t>(size / MIN_STAT_CHUNK_SIZE) + 1);
+            auto offsets = Stat_File::split(fn, parts);
+            for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+                chunks.push_back(std::make_unique<Stat_Chunk>(fn, offsets[i], offsets[i + 1]));
+            }
+        }
 
-        for(const auto &w: _word_id_map.nproper()) {
-            assert(_word_id_map.proper().find(w) == _word_id_map.proper().end());
-            _word_id_map.proper().erase(w);
+        std::cout << "Loading stat files (" << chunks.size() << " chunk(s), " << threads << " thread(s))...";
+        parallel_for(chunks.size(), threads, [&](size_t i) {
+            chunks[i]->ok = load_stats(*chunks[i], conv, numeric);
+        });
+        for (const auto &c: chunks) {
+            if (c->buffer.overflow()) {
+                std::cout << " Failed" << std::endl;
+                std::cerr << "Stat file " << c->filename << " has more than " << Stat_Buffer::MAX_WORDS
+                          << " words in a chunk or n-grams of more than " << Stat_Buffer::MAX_DEPTH << " words" << std::endl;
+                return false;
+            }
+            if (!c->ok) {
+                std::cout << " Failed" << std::endl;
+                std::cerr << "Cannot read stat file " << c->filename << std::endl;
+                return false;
+            }
         }
+        std::cout << " Done" << std::endl;
 
-        for(const auto &fn: stat_files) {
-            std::cout << "Loading stat file " << fn << "...";
-            load_stats(fn, conv);
-            std::cout << " Done" << std::endl;
+        Stat_Words words;
+        for (const auto &c: chunks) {
+            for (const auto &w: c->words.nproper) {
+                words.nproper[w.first] += w.second;
+            }
+            for (const auto &w: c->words.proper) {
+                words.proper[w.first] += w.second;
+            }
+            c->words = Stat_Words();
         }
 
+        auto p = select_stats_words(words, max_word_count, nproper);
+        for(const auto &w: p.first) {
+            assert(p.second.find(w) == p.second.end());
+            p.second.erase(w);
+        }
+        _word_id_map.set_vocabulary(std::move(p.first), std::move(p.second), std::move(numeric));
+
+        std::cout << "Building n-gram trees...";
+        build_stats(chunks, threads, compact);
+        std::cout << " Done" << std::endl;
+
         // must go after load_stats
         for(const auto &w: proper) {
             word_id id = _word_id_map.add_proper(w);
-            _proper_tree.add(_word_id_map, {{w, id}}, 1, true);
+            _proper_tree.add(_word_id_map, {{w, id}}, 1, true, compact);
+        }
+
+        if ((min_hits > 0) || (top_k > 0)) {
+            std::cout << "Pruning n-gram trees...";
+            size_t nodes = node_count();
+            size_t contexts = context_count();
+            std::cout << " (" << nodes << " nodes, " << contexts << " contexts, " << (frozen_bytes(nodes, contexts) >> 20) << " MB)";
+            _word_ngram_tree.prune(min_hits, top_k);
+            _proper_tree.prune(min_hits, top_k);
+            _numeric_tree.prune(min_hits, top_k);
+            nodes = node_count();
+            contexts = context_count();
+            std::cout << " Done (" << nodes << " nodes, " << contexts << " contexts, " << (frozen_bytes(nodes, contexts) >> 20) << " MB)" << std::endl;
         }
 
         /*{
-            const Word_Ngram_Tree *ngt = find_tree(word_ngram_tree(), "while", "in");
+            const Frozen_Ngram_Tree *ngt = find_tree(word_ngram_tree(), "while", "in");
             if (ngt != nullptr) {
                 ngt->print_frequencies(word_id_map(), 1000);
             }
         }
         {
-            const Word_Ngram_Tree *ngt = find_tree(numeric_tree(), "at");
+            const Frozen_Ngram_Tree *ngt = find_tree(numeric_tree(), "at");
             if (ngt != nullptr) {
                 ngt->print_frequencies(word_id_map(), 1000);
             }
         }*/
 
-        /*std::pair<score_t, size_t> nprop_av_score = */_word_ngram_tree.calc_scores(false);
+        /*std::pair<score_t, size_t> nprop_av_score = */_word_ngram_tree.calc_scores(false, threads);
         /*std::pair<score_t, size_t> prop_av_score = */_proper_tree.calc_scores(false);
         _numeric_tree.calc_scores(false);
 
+        std::cout << "Freezing trees...";
+        size_t nodes = node_count();
+        size_t contexts = context_count();
+        size_t capacity = frozen_bytes(nodes, contexts) / sizeof(Frozen_Tree);
+        if (compact) {
+            // word ranges of the tries and Word_Scores, a word takes less than a node in both
+            capacity += 2 * nodes + 2 * contexts;
+        }
+        _tree_arena.reserve(capacity);
+        _regions.clear();
+        _word_ngram_tree.freeze_trees(_tree_arena, compact, _regions);
+        _proper_tree.freeze_trees(_tree_arena, compact, _regions);
+        _numeric_tree.freeze_trees(_tree_arena, compact, _regions);
+        _tree_base = _tree_arena.data();
+        nodes = _tree_arena.size();
+        Word_Range *ranges = nullptr;
+        if (compact) {
+            ranges = _tree_arena.alloc_as<Word_Range>(nodes);
+            _word_ngram_tree.rank_words(_tree_base, ranges);
+            _proper_tree.rank_words(_tree_base, ranges);
+            _numeric_tree.rank_words(_tree_base, ranges);
+            // only the ranges of the root tries are used
+            add_region(_regions, nodes, _tree_arena.size(), 0);
+        }
+        _word_ranges = ranges;
+        Frozen_Ngram_Tree *word_ngram_root = _word_ngram_tree.freeze_contexts(_tree_arena, _regions);
+        Frozen_Ngram_Tree *proper_root = _proper_tree.freeze_contexts(_tree_arena, _regions);
+        Frozen_Ngram_Tree *numeric_root = _numeric_tree.freeze_contexts(_tree_arena, _regions);
+        if (compact) {
+            _word_ngram_tree.freeze_scores(_tree_arena, word_ngram_root, ranges, _regions);
+            _proper_tree.freeze_scores(_tree_arena, proper_root, ranges, _regions);
+            _numeric_tree.freeze_scores(_tree_arena, numeric_root, ranges, _regions);
+        }
+        _word_ngram_root = word_ngram_root;
+        _proper_root = proper_root;
+        _numeric_root = numeric_root;
+        _word_ngram_tree.clear();
+        _proper_tree.clear();
+        _numeric_tree.clear();
+        std::cout << " Done (" << nodes << " nodes, " << contexts << " contexts, " << (_tree_arena.bytes() >> 20) << " MB";
+        std::cout << (_tree_arena.huge() ? ", huge pages" : "") << ")" << std::endl;
+
         /*
         std::pair<score_t, size_t> total_av_score = {
             nprop_av_score.first + prop_av_score.first,
@@ -856,112 +1784,556 @@ public:
 
         /*std::cout << std::endl;
         test_next_word(word_ngram_tree(), "further", 0, COMMA, "wait", "for");*/
+        return true;
     }
 
-    const Word_Ngram_Tree &word_ngram_tree() const {
-        return _word_ngram_tree;
+    const Frozen_Ngram_Tree &word_ngram_tree() const {
+        return *_word_ngram_root;
+    }
+    const Frozen_Ngram_Tree &proper_tree() const {
+        return *_proper_root;
+    }
+    const Frozen_Ngram_Tree &numeric_tree() const {
+        return *_numeric_root;
     }
-    const Word_Ngram_Tree &proper_tree() const {
-        return _proper_tree;
+    // the length of the longest word of the root tries
+    size_t max_word_length() const {
+        return std::max({height(word_ngram_tree().tree()), height(proper_tree().tree()), height(numeric_tree().tree())});
     }
-    const Word_Ngram_Tree &numeric_tree() const {
-        return _numeric_tree;
+    // ranks of the words below the nodes of the root tries, only for the compact contexts
+    Word_Ranges word_ranges() const {
+        return Word_Ranges(_tree_base, _word_ranges);
     }
-    const Word_Ngram_Tree &prefix_tree_first() const {
+    const Frozen_Ngram_Tree &prefix_tree_first() const {
         return *(word_ngram_tree().find(COMMA));
     }
     const Word_Id_Map &word_id_map() const {
         return _word_id_map;
     }
+    // Contexts up to the order and their tries are read ahead from the mapped snapshot, higher orders
+    // are paged in only when the search reaches them. A dictionary which is not mapped is resident anyway
+    void prefetch(size_t order) const {
+        if (!_snapshot_file) {
+            return;
+        }
+        std::cout << "Paging dictionary snapshot...";
+        size_t ahead = 0;
+        size_t lazy = 0;
+        for (const auto &r: _regions) {
+            size_t begin = _snapshot_offset + r.begin * sizeof(Frozen_Tree);
+            size_t end = _snapshot_offset + r.end * sizeof(Frozen_Tree);
+            if (r.depth < order) {
+                _snapshot_file->will_need(begin, end);
+                ahead += end - begin;
+            }
+            else {
+                _snapshot_file->random(begin, end);
+                lazy += end - begin;
+            }
+        }
+        std::cout << " Done (" << (ahead >> 20) << " MB ahead, " << (lazy >> 20) << " MB on demand)" << std::endl;
+    }
+
+    // identifies the dictionary which the files and the parameters give
+    template <class _Conv>
+    static Snapshot_Key snapshot_key(const _Conv &, const std::vector<std::string> &stat_files, const std::vector<std::string> &nprop_files, const std::vector<std::string> &prop_files, const std::vector<std::string> &numeric_files, size_t max_word_count, bool compact, hits_t min_hits, size_t top_k) {
+        Snapshot_Key key;
+        key.add(SNAPSHOT_VERSION);
+        key.add(_Conv::name());
+        key.add(static_cast<uint64_t>(max_word_count));
+        key.add(compact);
+        key.add(min_hits);
+        key.add(static_cast<uint64_t>(top_k));
+        for (const auto *list: {&stat_files, &nprop_files, &prop_files, &numeric_files}) {
+            key.add(static_cast<uint64_t>(list->size()));
+            for (const auto &fn: *list) {
+                key.add_file(fn);
+            }
+        }
+        return key;
+    }
+    template <class _Conv>
+    static std::string snapshot_filename(const std::string &cache_dir, const _Conv &conv, const std::vector<std::string> &stat_files, const std::vector<std::string> &nprop_files, const std::vector<std::string> &prop_files, const std::vector<std::string> &numeric_files, size_t max_word_count, bool compact, hits_t min_hits, size_t top_k) {
+        Snapshot_Key key = snapshot_key(conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count, compact, min_hits, top_k);
+        return (std::filesystem::path(cache_dir) / ("dict_" + key.str() + ".pfd")).string();
+    }
+    bool load_snapshot(const std::string &filename) {
+        Snapshot_Reader r(filename);
+        if (!r.ok()) {
+            return false;
+        }
+        std::cout << "Loading dictionary snapshot " << filename << "...";
+        if ((r.read<uint64_t>() != SNAPSHOT_MAGIC) || (r.read<uint32_t>() != SNAPSHOT_VERSION)) {
+            std::cout << " Outdated" << std::endl;
+            return false;
+        }
+        _word_id_map.load(r);
+        size_t nodes = r.read_size(std::numeric_limits<uint32_t>::max());
+        std::array<uint32_t, 3> roots;
+        for (auto &index: roots) {
+            r.read(index);
+        }
+        uint32_t ranges = r.read<uint32_t>();
+        _regions.resize(r.read_size(MAX_REGIONS));
+        for (auto &region: _regions) {
+            r.read(region);
+        }
+        r.align(SNAPSHOT_ALIGNMENT);
+        uint64_t offset = r.tell();
+        const Frozen_Tree *base = nullptr;
+        auto file = std::make_unique<Mapped_File>(filename);
+        if (r.ok() && file->ok() && (offset + nodes * sizeof(Frozen_Tree) <= file->size())) {
+            // the pages of the file are shared by all the processes which use the snapshot
+            base = reinterpret_cast<const Frozen_Tree *>(file->data() + offset);
+            r.skip(nodes * sizeof(Frozen_Tree));
+            _snapshot_file = std::move(file);
+            _snapshot_offset = static_cast<size_t>(offset);
+        }
+        else {
+            _tree_arena.reserve(nodes);
+            r.read(_tree_arena.alloc(nodes), nodes * sizeof(Frozen_Tree));
+            base = _tree_arena.data();
+        }
+        _word_ngram_root = find_root(base, nodes, roots[0]);
+        _proper_root = find_root(base, nodes, roots[1]);
+        _numeric_root = find_root(base, nodes, roots[2]);
+        _tree_base = base;
+        if (ranges != 0) {
+            // one range per node of the whole arena, the contexts do not keep their own tries
+            bool fits = (ranges <= nodes) && ((nodes - ranges) * sizeof(Frozen_Tree) >= nodes * sizeof(Word_Range));
+            _word_ranges = fits ? reinterpret_cast<const Word_Range *>(base + ranges) : nullptr;
+        }
+        bool found = (_word_ngram_root != nullptr) && (_proper_root != nullptr) && (_numeric_root != nullptr) &&
+            ((ranges == 0) || (_word_ranges != nullptr));
+        for (const auto &region: _regions) {
+            found = found && (region.begin <= region.end) && (region.end <= nodes);
+        }
+        if (!r.ok() || !found || (r.read<uint64_t>() != SNAPSHOT_MAGIC)) {
+            std::cout << " Damaged" << std::endl;
+            _word_id_map = Word_Id_Map();
+            _word_ngram_root = _proper_root = _numeric_root = nullptr;
+            _tree_base = nullptr;
+            _word_ranges = nullptr;
+            _regions.clear();
+            _tree_arena.release();
+            _snapshot_file.reset();
+            return false;
+        }
+        std::cout << " Done" << (_snapshot_file ? " (shared)" : "") << std::endl;
+        return true;
+    }
+    void save_snapshot(const std::string &filename) const {
+        // other processes may look for the same snapshot, so it appears under its name only when complete
+        std::string tmp = filename + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+        std::cout << "Saving dictionary snapshot " << filename << "...";
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(filename).parent_path(), ec);
+        {
+            Snapshot_Writer w(tmp);
+            w.write(SNAPSHOT_MAGIC);
+            w.write(SNAPSHOT_VERSION);
+            _word_id_map.save(w);
+            w.write(static_cast<uint64_t>(_tree_arena.size()));
+            for (const auto *root: {_word_ngram_root, _proper_root, _numeric_root}) {
+                w.write(static_cast<uint32_t>(_tree_arena.index(reinterpret_cast<const Frozen_Tree *>(root))));
+            }
+            w.write(static_cast<uint32_t>(_word_ranges ? _tree_arena.index(reinterpret_cast<const Frozen_Tree *>(_word_ranges)) : 0));
+            w.write(static_cast<uint64_t>(_regions.size()));
+            for (const auto &region: _regions) {
+                w.write(region);
+            }
+            w.align(SNAPSHOT_ALIGNMENT);
+            w.write(_tree_arena.data(), _tree_arena.bytes());
+            w.write(SNAPSHOT_MAGIC);
+            if (!w.ok()) {
+                std::cout << " Failed" << std::endl;
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, filename, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            std::cout << " Failed" << std::endl;
+            return;
+        }
+        std::cout << " Done" << std::endl;
+    }
 private:
+    static const Frozen_Ngram_Tree *find_root(const Frozen_Tree *base, size_t nodes, size_t index) {
+        if (index + sizeof(Frozen_Ngram_Tree) / sizeof(Frozen_Tree) > nodes) {
+            return nullptr;
+        }
+        return reinterpret_cast<const Frozen_Ngram_Tree *>(base + index);
+    }
+    static size_t height(const Frozen_Tree &node) {
+        size_t result = 0;
+        for (auto t = node.next_char_begin(); t != node.next_char_end(); ++t) {
+            result = std::max(result, height(*t) + 1);
+        }
+        return result;
+    }
+    // The file is mapped and parsed in place, the lines and the words are views into the mapping.
+    // A compressed file is streamed through its decompressor instead and parsed block by block as a whole
     class Stat_File {
     public:
-        Stat_File(const std::string &filename): file(filename) {
+        Stat_File(const std::string &filename): Stat_File(filename, 0, std::numeric_limits<uint64_t>::max()) {
+        }
+        Stat_File(const std::string &filename, uint64_t begin, uint64_t end): command(decompressor(filename)),
+        file(command.empty() ? filename : std::string()),
+        pos(static_cast<size_t>(std::min<uint64_t>(begin, file.size()))), end(static_cast<size_t>(std::min<uint64_t>(end, file.size()))) {
+            file.sequential(pos, end);
+        }
+        // false when the file is malformed or truncated, or its decompressor has failed
+        template <class _C, class _F>
+        bool read(const _C &conv, const _F &proc) {
+            std::vector<uint32_t> words;
+            if (!command.empty()) {
+                Pipe_Reader pipe(command);
+                std::string block;
+                bool ok = true;
+                while (ok && pipe.next(block)) {
+                    size_t p = 0;
+                    ok = parse(block, p, block.size(), words, conv, proc);
+                }
+                if (!ok || !pipe.ok()) {
+                    std::cerr << "Failed: " << command << std::endl;
+                    return false;
+                }
+            }
+            else if (!file.ok() || !parse(file.view(), pos, end, words, conv, proc)) {
+                return false;
+            }
+            return words.empty();
+        }
+        // Offsets of lines which start the n-gram lists of the first level. Any of them may begin a chunk
+        // which is parsed independently from the others, one per thread. A compressed file is one chunk
+        static std::vector<uint64_t> split(const std::string &filename, size_t parts) {
+            std::vector<uint64_t> result = {0};
+            if ((parts <= 1) || !decompressor(filename).empty()) {
+                result.push_back(std::numeric_limits<uint64_t>::max());
+                return result;
+            }
+            Mapped_File file(filename);
+            if (!file.ok()) {
+                result.push_back(std::numeric_limits<uint64_t>::max());
+                return result;
+            }
+            std::string_view data = file.view();
+            file.sequential(0, data.size());
+            size_t pos = 0;
+            int64_t depth = 0;
+            size_t target = data.size() / parts;
+            while (pos < data.size()) {
+                size_t line = pos;
+                std::string_view s = next_line(data, pos);
+                if (s.empty() || (s.front() == '\r')) {
+                    continue;
+                }
+                if (s.front() == '-') {
+                    depth--;
+                }
+                else {
+                    if ((depth == 0) && (line >= target)) {
+                        result.push_back(line);
+                        target = line + data.size() / parts;
+                    }
+                    if (s.front() != '=') {
+                        depth++;
+                    }
+                }
+            }
+            result.push_back(std::numeric_limits<uint64_t>::max());
+            return result;
+        }
+    protected:
+        // command which writes the decompressed file to its output, empty for a plain file
+        static std::string decompressor(const std::string &filename) {
+            std::ifstream f(filename, std::ios::binary);
+            std::array<unsigned char, 4> magic = {};
+            f.read(reinterpret_cast<char *>(magic.data()), static_cast<std::streamsize>(magic.size()));
+            if ((magic[0] == 0x1f) && (magic[1] == 0x8b)) {
+                return "gzip -dc " + Pipe_Reader::quote(filename);
+            }
+            if ((magic[0] == 0x28) && (magic[1] == 0xb5) && (magic[2] == 0x2f) && (magic[3] == 0xfd)) {
+                return "zstd -dcq " + Pipe_Reader::quote(filename);
+            }
+            return std::string();
         }
         template <class _C, class _F>
-        void read(const _C &conv, const _F &proc) {
-            std::string s;
-            std::vector<std::pair<std::string, word_id>> words;
-            while (getline(file, s)) {
+        static bool parse(const std::string_view &data, size_t &pos, size_t end, std::vector<uint32_t> &words, const _C &conv, const _F &proc) {
+            while (pos < end) {
+                std::string_view s = next_line(data, pos);
+                if (!s.empty() && (s.back() == '\r')) {
+                    s.remove_suffix(1);
+                }
+                if (s.empty()) {
+                    continue;
+                }
                 char ch = s.front();
                 if (ch == '-') {
+                    if (words.empty()) {
+                        return false;
+                    }
                     words.pop_back();
                 }
                 else {
                     size_t k = s.find(' ');
-                    words.emplace_back(conv(s.substr(1, k - 1)));
-                    hits_t cnt = static_cast<hits_t>(std::stoi(s.substr(k + 1)));
-                    proc(words, cnt);
+                    if (k == std::string_view::npos) {
+                        return false;
+                    }
+                    hits_t hits = 0;
+                    if (!parse_hits(s.substr(k + 1), hits)) {
+                        return false;
+                    }
+                    words.push_back(conv(s.substr(1, k - 1)));
+                    proc(words, hits);
                     if (ch == '=') {
                         words.pop_back();
                     }
                 }
             }
-            assert(words.empty());
+            return true;
         }
-    protected:
-        std::ifstream file;
+        static std::string_view next_line(const std::string_view &data, size_t &pos) {
+            size_t eol = data.find('\n', pos);
+            if (eol == std::string_view::npos) {
+                eol = data.size();
+            }
+            std::string_view result = data.substr(pos, eol - pos);
+            pos = eol + 1;
+            return result;
+        }
+        // false for an empty count, other symbols than digits (but a final '\r') or a count above hits_t
+        static bool parse_hits(std::string_view s, hits_t &hits) {
+            if (!s.empty() && (s.back() == '\r')) {
+                s.remove_suffix(1);
+            }
+            hits = 0;
+            for (char ch: s) {
+                if ((ch < '0') || (ch > '9')) {
+                    return false;
+                }
+                hits_t digit = static_cast<hits_t>(ch - '0');
+                if (hits > (std::numeric_limits<hits_t>::max() - digit) / 10) {
+                    return false;
+                }
+                hits = hits * 10 + digit;
+            }
+            return !s.empty();
+        }
+
+        std::string command;
+        Mapped_File file;
+        size_t      pos;
+        size_t      end;
+    };
+    // Every stat file is parsed once: words are interned and n-grams are kept as compact records,
+    // which are replayed into the trees after the vocabulary has been selected
+    class Stat_Buffer {
+    public:
+        static constexpr uint32_t MAX_DEPTH = (1 << 5) - 1;
+        static constexpr uint32_t MAX_WORDS = (1 << 27) - 1;
+
+        struct Record {
+            uint32_t    word:27;
+            uint32_t    depth:5;
+            hits_t      hits;
+        };
+        struct Word_Info {
+            std::string tree_word;  // form used by the trees
+            std::string lower;      // form used by the vocabulary
+            bool        lower_case; // converted word had no capitals
+            bool        article;
+            bool        valid;      // passes test_word
+        };
+        template <class _Conv>
+        uint32_t intern(const std::string_view &v, const _Conv &conv) {
+            auto it = _ids.find(v);
+            if (it != _ids.end()) {
+                return it->second;
+            }
+            const std::string &s = _names.emplace_back(v);
+            std::string w = conv(s);
+            std::string lw = to_lower(w);
+            bool article = (lw == "the") || (lw == "a") || (lw == "an");
+            bool valid = test_word(lw);
+            bool lower_case = (w == lw);
+            if (_words.size() >= MAX_WORDS) {
+                _overflow = true;
+                return MAX_WORDS;
+            }
+            uint32_t n = static_cast<uint32_t>(_words.size());
+            _words.push_back({conv(to_lower(s)), std::move(lw), lower_case, article, valid});
+            _ids.emplace(s, n);
+            return n;
+        }
+        // false when the word or the depth do not fit in a record, and for every n-gram after that
+        bool add(uint32_t word, size_t depth, hits_t hits) {
+            if ((word >= MAX_WORDS) || (depth > MAX_DEPTH)) {
+                _overflow = true;
+            }
+            if (_overflow) {
+                return false;
+            }
+            _records.push_back({word & MAX_WORDS, static_cast<uint32_t>(depth) & MAX_DEPTH, hits});
+            return true;
+        }
+        // more than MAX_WORDS words or n-grams deeper than MAX_DEPTH have been met
+        bool overflow() const {
+            return _overflow;
+        }
+        const Word_Info &word(uint32_t n) const {
+            return _words[n];
+        }
+        size_t word_count() const {
+            return _words.size();
+        }
+        const std::deque<Record> &records() const {
+            return _records;
+        }
+    private:
+        // the keys are views of _names, a deque never moves its elements
+        Map_Type<std::string_view, uint32_t>    _ids;
+        std::deque<std::string>         _names;
+        std::vector<Word_Info>          _words;
+        std::deque<Record>              _records;
+        bool                            _overflow = false;
     };
+
+    class Stat_Words {
+    public:
+        std::map<std::string, hits_t> nproper, proper;
+    };
+
+    // a part of a stat file, it is parsed and turned into partial trees by one thread
+    class Stat_Chunk {
+    public:
+        Stat_Chunk(const std::string &filename, uint64_t begin, uint64_t end): filename(filename), begin(begin), end(end) {
+        }
+        std::string         filename;
+        uint64_t            begin;
+        uint64_t            end;
+        Stat_Buffer         buffer;
+        Stat_Words          words;
+        std::vector<word_id>    ids;
+        Word_Ngram_Tree     word_ngram_tree;
+        Word_Ngram_Tree     proper_tree;
+        Word_Ngram_Tree     numeric_tree;
+        bool                ok = false;
+    };
+
+    size_t node_count() const {
+        return _word_ngram_tree.node_count() + _proper_tree.node_count() + _numeric_tree.node_count();
+    }
+    size_t context_count() const {
+        return _word_ngram_tree.context_count() + _proper_tree.context_count() + _numeric_tree.context_count();
+    }
+    // size of the trees in the arena, without the compact contexts
+    static size_t frozen_bytes(size_t nodes, size_t contexts) {
+        return nodes * sizeof(Frozen_Tree) + contexts * sizeof(Frozen_Ngram_Tree);
+    }
+
+    // the letters which the converter keeps, j is not among them when it is joined with i
     template <class _Conv>
-    void load_stats(const std::string &filename, const _Conv &conv) {
-        Stat_File f(filename);
-        f.read([&](const std::string &s) -> std::pair<std::string, word_id> {
-            std::string w = conv(to_lower(s));
-            word_id id = _word_id_map.add(w);
-            return {std::move(w), id};
+    static std::string cleartext_letters(const _Conv &conv) {
+        std::string result;
+        for (char ch: std::string("taioswcbphfmdrelngyukvjqxz")) {
+            if (conv(std::string(1, ch)) == std::string(1, ch)) {
+                result.push_back(ch);
+            }
+        }
+        return result;
+    }
+
+    static constexpr uint64_t MIN_STAT_CHUNK_SIZE = 64 << 20;
+    static constexpr uint64_t MAX_REGIONS = 1 << 16;
+
+    template <class _Conv>
+    bool load_stats(Stat_Chunk &chunk, const _Conv &conv, const std::set<std::string> &numeric) {
+        Stat_Buffer &buffer = chunk.buffer;
+        Stat_Words &vocabulary = chunk.words;
+        Stat_File f(chunk.filename, chunk.begin, chunk.end);
+        return f.read([&](const std::string_view &s) {
+            return buffer.intern(s, conv);
         },
-        [&](const auto &words, hits_t cnt) {
-            _word_ngram_tree.add(_word_id_map, words, cnt, false);
-            if ((words.size() <= 2) && (_word_id_map.category(words.back().second) == PROPER)) {
-                _proper_tree.add(_word_id_map, words, cnt, true);
+        [&](const std::vector<uint32_t> &words, hits_t cnt) {
+            if (!buffer.add(words.back(), words.size(), cnt)) {
+                return;
             }
-            if ((words.size() <= 2) && (_word_id_map.category(words.back().second) == NUMERIC) && (words.back().second != NUMERIC)) {
-                _numeric_tree.add(_word_id_map, words, cnt, true);
+            if ((words.size() == 0) || (words.size() > 2)) {
+                return;
+            }
+            const Stat_Buffer::Word_Info &w = buffer.word(words.back());
+            const std::string &ls = w.lower;
+            if (!w.valid) {
+                return;
+            }
+            if (numeric.find(ls) != numeric.end()) {
+                return;
+            }
+            //1-letter words except a and i are proper names
+            if ((ls.size() == 1) && (ls != "a") && (ls != "i")) {
+                vocabulary.proper[ls] += cnt;
+                return;
+            }
+            if (w.lower_case || (buffer.word(words[0]).article && (words.size() == 2))) {
+                vocabulary.nproper[ls] += cnt;
+            }
+            else {
+                vocabulary.proper[ls] += cnt;
             }
         });
     }
-    template <class _Conv>
-    std::pair<std::set<std::string>, std::set<std::string>> load_stats_words(const std::vector<std::string> &stat_files, size_t limit, const _Conv &conv, const std::set<std::string> &nproper_protected, const std::set<std::string> &numeric) {
-        constexpr word_id ARTICLE = 1;
-        std::map<std::string, hits_t> nproper, proper;
-
-        for(const auto &fn: stat_files) {
-            std::cout << "Loading vocabulary from stat file " << fn << "...";
-
-            Stat_File f(fn);
-            f.read([&](const std::string &s) -> std::pair<std::string, word_id> {
-                std::string w = conv(s);
-                std::string lw = to_lower(w);
-                word_id t = ((lw == "the") || (lw == "a") || (lw == "an")) ? ARTICLE : NONE;
-                return {std::move(w), t};
-            },
-            [&](const auto &words, hits_t cnt) {
-                if ((words.size() == 0) || (words.size() > 2)) {
-                    return;
-                }
-                std::string s = words.back().first;
-                std::string ls = to_lower(s);
-                if (!test_word(ls)) {
-                    return;
-                }
-                if (numeric.find(ls) != numeric.end()) {
-                    return;
-                }
-                //1-letter words except a and i are proper names
-                if ((ls.size() == 1) && (ls != "a") && (ls != "i")) {
-                    proper[ls] += cnt;
-                    return;
-                }
-                if ((s == ls) || ((words[0].second == ARTICLE) && (words.size() == 2))) {
-                    nproper[ls] += cnt;
-                }
-                else {
-                    proper[ls] += cnt;
+    void build_stats(std::vector<std::unique_ptr<Stat_Chunk>> &chunks, size_t threads, bool compact) {
+        // ids are assigned in the order the words are met in the files, chunk by chunk
+        for (auto &c: chunks) {
+            c->ids.resize(c->buffer.word_count());
+            for (size_t i = 0; i < c->ids.size(); ++i) {
+                c->ids[i] = _word_id_map.add(c->buffer.word(static_cast<uint32_t>(i)).tree_word);
+            }
+        }
+        parallel_for(chunks.size(), threads, [&](size_t i) {
+            build_stats(*chunks[i], compact);
+        });
+        for (size_t step = 1; step < chunks.size(); step *= 2) {
+            parallel_for((chunks.size() + 2 * step - 1) / (2 * step), threads, [&](size_t i) {
+                size_t a = i * 2 * step;
+                size_t b = a + step;
+                if (b < chunks.size()) {
+                    chunks[a]->word_ngram_tree.merge(chunks[b]->word_ngram_tree);
+                    chunks[a]->proper_tree.merge(chunks[b]->proper_tree);
+                    chunks[a]->numeric_tree.merge(chunks[b]->numeric_tree);
                 }
             });
+        }
+        if (!chunks.empty()) {
+            _word_ngram_tree.merge(chunks[0]->word_ngram_tree);
+            _proper_tree.merge(chunks[0]->proper_tree);
+            _numeric_tree.merge(chunks[0]->numeric_tree);
+        }
+        chunks.clear();
+    }
+    void build_stats(Stat_Chunk &chunk, bool compact) {
+        const Stat_Buffer &buffer = chunk.buffer;
+        Word_Id_List words;
+        for (const auto &r: buffer.records()) {
+            words.resize(r.depth - 1);
+            words.emplace_back(buffer.word(r.word).tree_word, chunk.ids[r.word]);
 
-            std::cout << " Done" << std::endl;
+            chunk.word_ngram_tree.add(_word_id_map, words, r.hits, false, compact);
+            if ((words.size() <= 2) && (_word_id_map.category(words.back().second) == PROPER)) {
+                chunk.proper_tree.add(_word_id_map, words, r.hits, true, compact);
+            }
+            if ((words.size() <= 2) && (_word_id_map.category(words.back().second) == NUMERIC) && (words.back().second != NUMERIC)) {
+                chunk.numeric_tree.add(_word_id_map, words, r.hits, true, compact);
+            }
         }
+        chunk.buffer = Stat_Buffer();
+    }
+    std::pair<std::set<std::string>, std::set<std::string>> select_stats_words(Stat_Words &vocabulary, size_t limit, const std::set<std::string> &nproper_protected) {
+        std::map<std::string, hits_t> &nproper = vocabulary.nproper;
+        std::map<std::string, hits_t> &proper = vocabulary.proper;
 
         auto it_p = proper.begin();
         while (it_p != proper.end()) {
@@ -1022,8 +2394,155 @@ private:
         return {to_set(nproper), to_set(proper)};
     }
 
+    Arena<Frozen_Tree>  _tree_arena;
+    std::unique_ptr<Mapped_File>    _snapshot_file;
+    size_t              _snapshot_offset = 0;
+    std::vector<Tree_Region>    _regions;
+    const Frozen_Tree   *_tree_base = nullptr;
+    const Word_Range    *_word_ranges = nullptr;
+    const Frozen_Ngram_Tree *_word_ngram_root = nullptr;
+    const Frozen_Ngram_Tree *_proper_root = nullptr;
+    const Frozen_Ngram_Tree *_numeric_root = nullptr;
     Word_Ngram_Tree     _proper_tree;
     Word_Ngram_Tree     _numeric_tree;
     Word_Ngram_Tree     _word_ngram_tree;
     Word_Id_Map         _word_id_map;
+    std::string         _letters;
+    bool                _ok = true;
+};
+
+// Copies of the root tries of a dictionary for one task, without the words which the task can never place.
+// Which words fit depends on the position of the cleartext where a word starts. The positions are grouped
+// into classes, classes[position] is the class of a position and every class has copies of its own.
+// allowed(cls, prefix, ch) tells if ch may follow the prefix of a word of the class. The dead branches are
+// dropped, so the search does not enter them. The minimal scores of the source are kept: the score limit
+// grows along the text, so a bound tightened at the start of a word would cut words which are accepted later
+class Dictionary_View {
+public:
+    template <class _F>
+    Dictionary_View(const Dictionary &dict, const std::vector<size_t> &classes, const _F &allowed):
+    _roots{&dict.word_ngram_tree(), &dict.proper_tree(), &dict.numeric_tree()}, _classes(classes), _trees(),
+    _source_nodes(0), _nodes(), _ranges() {
+        assert(!_classes.empty());
+        _trees.resize(*std::max_element(_classes.begin(), _classes.end()) + 1);
+        std::array<size_t, 3> extents;
+        for (size_t i = 0; i < _roots.size(); ++i) {
+            const Frozen_Tree &root = _roots[i]->tree();
+            _source_nodes += _trees.size() * count(root);
+            extents[i] = extent(root, root);
+        }
+        Word_Ranges ranges = dict.word_ranges();
+        std::vector<char> alive;
+        std::string prefix;
+        for (size_t cls = 0; cls < _trees.size(); ++cls) {
+            for (size_t i = 0; i < _roots.size(); ++i) {
+                const Frozen_Tree &root = _roots[i]->tree();
+                alive.assign(extents[i], 0);
+                mark(root, root, cls, prefix, allowed, alive);
+                _trees[cls][i] = _nodes.size();
+                _nodes.emplace_back();
+                if (!ranges.empty()) {
+                    _ranges.emplace_back();
+                }
+                copy(root, root, _trees[cls][i], alive, ranges);
+            }
+        }
+        assert(_nodes.size() <= _source_nodes);
+    }
+    Dictionary_View(const Dictionary_View &) = delete;
+    Dictionary_View &operator=(const Dictionary_View &) = delete;
+    // copy of the trie of a root context for a word starting at the position
+    const Frozen_Tree &tree(const Frozen_Ngram_Tree &root, size_t position) const {
+        for (size_t i = 0; i < _roots.size(); ++i) {
+            if (_roots[i] == &root) {
+                return _nodes[_trees[_classes[std::min(position, _classes.size() - 1)]][i]];
+            }
+        }
+        return root.tree();
+    }
+    Word_Ranges word_ranges() const {
+        return Word_Ranges(_nodes.data(), _ranges.empty() ? nullptr : _ranges.data());
+    }
+    size_t class_count() const {
+        return _trees.size();
+    }
+    size_t node_count() const {
+        return _nodes.size();
+    }
+    // nodes of the source tries, once for every class
+    size_t source_node_count() const {
+        return _source_nodes;
+    }
+private:
+    static size_t count(const Frozen_Tree &node) {
+        size_t result = 1;
+        for (auto t = node.next_char_begin(); t != node.next_char_end(); ++t) {
+            result += count(*t);
+        }
+        return result;
+    }
+    // all the nodes of a frozen trie follow its root
+    static size_t extent(const Frozen_Tree &node, const Frozen_Tree &root) {
+        size_t result = static_cast<size_t>(&node - &root) + 1;
+        for (auto t = node.next_char_begin(); t != node.next_char_end(); ++t) {
+            result = std::max(result, extent(*t, root));
+        }
+        return result;
+    }
+    // a node is alive if there is a word left at it or below
+    template <class _F>
+    static bool mark(const Frozen_Tree &node, const Frozen_Tree &root, size_t cls, std::string &prefix, const _F &allowed, std::vector<char> &alive) {
+        if (&node != &root) {
+            if (!allowed(cls, prefix, node.symbol())) {
+                return false;
+            }
+            prefix.push_back(node.symbol());
+        }
+        bool result = node.is_word();
+        for (auto t = node.next_char_begin(); t != node.next_char_end(); ++t) {
+            result = mark(*t, root, cls, prefix, allowed, alive) || result;
+        }
+        if (&node != &root) {
+            prefix.pop_back();
+        }
+        alive[static_cast<size_t>(&node - &root)] = result ? 1 : 0;
+        return result;
+    }
+    // the place of the node is allocated by its parent, children arrays follow as in Prefix_Tree::freeze()
+    void copy(const Frozen_Tree &from, const Frozen_Tree &root, size_t to, const std::vector<char> &alive, const Word_Ranges &ranges) {
+        Frozen_Tree node = from;
+        node._next = 0;
+        node._size = 0;
+        node._mask = 0;
+        size_t first = _nodes.size();
+        for (auto t = from.next_char_begin(); t != from.next_char_end(); ++t) {
+            if (alive[static_cast<size_t>(t - &root)]) {
+                node._size = (node._size + 1) & ((1 << 5) - 1);
+                node._mask |= symbol_bit(t->symbol());
+            }
+        }
+        _nodes.resize(first + node._size);
+        if (!ranges.empty()) {
+            _ranges.resize(first + node._size);
+            _ranges[to] = ranges(from);
+        }
+        size_t i = first;
+        for (auto t = from.next_char_begin(); t != from.next_char_end(); ++t) {
+            if (alive[static_cast<size_t>(t - &root)]) {
+                copy(*t, root, i, alive, ranges);
+                i++;
+            }
+        }
+        if (node._size > 0) {
+            node._next = static_cast<uint32_t>(first - to);
+        }
+        _nodes[to] = node;
+    }
+
+    std::array<const Frozen_Ngram_Tree *, 3>    _roots;
+    std::vector<size_t>                         _classes;
+    std::vector<std::array<size_t, 3>>          _trees;
+    size_t                      _source_nodes;
+    std::vector<Frozen_Tree>    _nodes;
+    std::vector<Word_Range>     _ranges;
 };
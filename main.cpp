@@ -3,20 +3,51 @@
  */
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <array>
 #include <set>
 #include <map>
 #include <unordered_map>
 #include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <filesystem>
 #include <iomanip>
 #include <chrono>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <cstdio>
 #include <string>
 #include <cmath>
 #include <future>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <random>
+#include <stdexcept>
 #include <assert.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <csignal>
+#endif
+#include <snapshot.h>
+#include <arena.h>
+#include <mapped_file.h>
+#include <pipe_reader.h>
+#include <counters.h>
 #include <dict.h>
+#include <checkpoint.h>
 #include <simple.h>
 #include <playfair.h>
 #include <chaotic.h>
@@ -25,8 +56,8 @@ class Result {
 public:
     using Result_List = std::map<score_t, std::set<Word_List>>;
 
-    Result(const Word_Id_Map &word_id_map, size_t low_score_area, score_t low_score_limit,  score_t high_score_limit, size_t print_solutions):
-    _start(std::chrono::steady_clock::now()), _word_id_map(word_id_map),
+    Result(const Word_Id_Map &word_id_map, size_t low_score_area, score_t low_score_limit,  score_t high_score_limit, size_t print_solutions, std::ostream &out):
+    _start(std::chrono::steady_clock::now()), _out(out), _word_id_map(word_id_map),
     _low_score_area(low_score_area), _low_score_limit(low_score_limit), _high_score_limit(high_score_limit),
     _print_solutions(print_solutions), _best_size(0) {
     }
@@ -39,20 +70,34 @@ public:
     score_t high_score_limit() const {
         return _high_score_limit;
     }
+    // the limits of the next round of threshold deepening, no search may run
+    void widen(score_t step) {
+        _low_score_limit += step;
+        _high_score_limit += step;
+        _best_size = 0;
+    }
+    size_t solution_count() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        size_t count = 0;
+        for(const auto &bs: _best_list) {
+            count += bs.second.size();
+        }
+        return count;
+    }
     template <class _Solution>
     void add_to_list(const std::string &name, Result_List &list, const std::string &text, score_t score, const _Solution &solution, const Word_List &words) {
         if (list[score].insert(words).second) {
             bool list_updated = (score <= last_printed(list, false));
             if ((_print_solutions >= 2) || ((_print_solutions >= 1) && list_updated)) {
                 print_time();
-                std::cout << "  " << name << ": " << text.size() << " (";
-                std::cout << _low_score_area << "/" << score_to_str(_low_score_limit) << "/" << score_to_str(_high_score_limit);
-                std::cout << ")" << std::endl;
-                std::cout << "  " << text << std::endl;
-                std::cout << "  (" << score_to_str(score) << "): ";
+                _out << "  " << name << ": " << text.size() << " (";
+                _out << _low_score_area << "/" << score_to_str(_low_score_limit) << "/" << score_to_str(_high_score_limit);
+                _out << ")" << std::endl;
+                _out << "  " << text << std::endl;
+                _out << "  (" << score_to_str(score) << "): ";
                 print_words(words);
-                std::cout << std::endl;
-                std::cout << "  =" << solution.key() << "=" << std::endl;
+                _out << std::endl;
+                _out << "  =" << solution.key() << "=" << std::endl;
             }
             if (list_updated) {
                 print_result_list(name, list, false);
@@ -70,27 +115,53 @@ public:
             std::lock_guard<std::mutex> lock(_mtx);
             _best_size = text.size();
             print_time();
-            std::cout << " Improvement: " << _best_size << " (";
-            std::cout << _low_score_area << "/" << score_to_str(_low_score_limit) << "/" << score_to_str(_high_score_limit);
-            std::cout << ")" << std::endl;
-            std::cout << "  " << text << std::endl;
-            std::cout << "  (" << score<< "): ";
+            _out << " Improvement: " << _best_size << " (";
+            _out << _low_score_area << "/" << score_to_str(_low_score_limit) << "/" << score_to_str(_high_score_limit);
+            _out << ")" << std::endl;
+            _out << "  " << text << std::endl;
+            _out << "  (" << score<< "): ";
             print_words(words);
-            std::cout << std::endl;
-            std::cout << "  =" << solution.key() << "=" << std::endl;
+            _out << std::endl;
+            _out << "  =" << solution.key() << "=" << std::endl;
         }
     }
     void print_state(size_t t, const std::string &s, size_t n, size_t total) {
         std::lock_guard<std::mutex> lock(_mtx);
         print_time();
-        std::cout << " t" << t << ": " << s << " (" << n << "/" << total << ")" << std::endl;
+        _out << " t" << t << ": " << s << " (" << n << "/" << total << ")" << std::endl;
+    }
+    // the solutions of a task which has been stopped, to resume it with
+    Result_List best_list() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _best_list;
+    }
+    void restore(const Result_List &list) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _best_list = list;
+    }
+#ifdef PLAYFAIR_COUNTERS
+    void add_counters(const Counters &counters) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _counters.merge(counters);
+    }
+    void print_counters(const std::string &matcher) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _out << "Counters: ";
+        _counters.print_json(_out, matcher);
+        _out << std::endl;
+    }
+#endif
+    void print_progress(const std::string &line) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        print_time();
+        _out << " " << line << std::endl;
     }
     void print_result_lists(bool final) {
         print_result_list("Best", _best_list, final);
     }
     void print_time() const {
         auto d = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start);
-        std::cout << "[" << d.count() << "]";
+        _out << "[" << d.count() << "]";
     }
 
     score_t last_printed(const Result_List &list, bool final) const {
@@ -116,29 +187,29 @@ public:
         }
 
         print_time();
-        std::cout << "  " << name;
+        _out << "  " << name;
         if (final) {
-            std::cout << " final ";
+            _out << " final ";
         }
         else {
-            std::cout << " current top ";
+            _out << " current top ";
         }
-        std::cout << printed << " result(s)";
+        _out << printed << " result(s)";
         if (printed != total) {
-            std::cout << " of " << total;
+            _out << " of " << total;
         }
-        std::cout << " (";
-        std::cout << _low_score_area << "/" << score_to_str(_low_score_limit) << "/" << score_to_str(_high_score_limit);
-        std::cout << "):" << std::endl;
+        _out << " (";
+        _out << _low_score_area << "/" << score_to_str(_low_score_limit) << "/" << score_to_str(_high_score_limit);
+        _out << "):" << std::endl;
         size_t p = 0;
         for(const auto &bs: list) {
             if (p < printed) {
                 for(const auto &wl: bs.second) {
-                    std::cout << "  (" << score_to_str(bs.first) << "): ";
+                    _out << "  (" << score_to_str(bs.first) << "): ";
                     for(auto w: wl) {
-                        std::cout << _word_id_map.word_by_id(w.id()) << " ";
+                        _out << _word_id_map.word_by_id(w.id()) << " ";
                     }
-                    std::cout << std::endl;
+                    _out << std::endl;
                 }
                 p += bs.second.size();
             }
@@ -150,23 +221,24 @@ public:
 private:
     void print_words(const Word_List &words) const {
         for(auto w: words) {
-            std::cout << _word_id_map.word_by_id(w.id()) << "(" << score_to_str(w.score());
+            _out << _word_id_map.word_by_id(w.id()) << "(" << score_to_str(w.score());
             if (w.category() > 0) {
-                std::cout << "+" << score_to_str(w.category());
+                _out << "+" << score_to_str(w.category());
                 if (_word_id_map.category(w.id()) == PROPER) {
-                    std::cout << "p";
+                    _out << "p";
                 }
                 else if (_word_id_map.category(w.id()) == NUMERIC) {
-                    std::cout << "u";
+                    _out << "u";
                 }
             }
             if (w.other() > w.score()) {
-                std::cout << "|" << score_to_str(w.other()) << "o";
+                _out << "|" << score_to_str(w.other()) << "o";
             }
-            std::cout << ") ";
+            _out << ") ";
         }
     }
     Ticks               _start;
+    std::ostream        &_out;
     const Word_Id_Map   &_word_id_map;
     size_t              _low_score_area;
     score_t             _low_score_limit;
@@ -174,21 +246,448 @@ private:
     size_t              _print_solutions;
     size_t              _best_size;
     Result_List         _best_list;
+#ifdef PLAYFAIR_COUNTERS
+    Counters            _counters;
+#endif
     std::mutex          _mtx;
 };
 
+class Job;
+
+// A part of the search of a job: the subtree of a cleartext prefix, or only the siblings lo..hi - 1 inside
+// of it which a busy worker has donated. The path holds the alternative taken at every branch point down to them
+struct Work {
+    Job                     *job;
+    std::string             prefix;
+    std::vector<uint32_t>   path;
+    uint32_t                lo;
+    uint32_t                hi;
+};
+
+// One search run on the workers of a scheduler. Its prefixes are split down to the depth into the letters
+// of the cleartext, search(n, work) searches a work on the worker n. The job is over when no work of it is pending
+class Job {
+public:
+    template <class _F>
+    Job(size_t depth, size_t max_depth, const std::string &letters, Result &result, const _F &search):
+    _depth(std::min(depth, max_depth)), _split_depth(std::min(depth + MAX_EXTRA_DEPTH, max_depth)),
+    _letters(letters), _result(result), _search(search), _pending(0), _started(0), _nodes(0), _interval(0) {
+    }
+    Job(const Job &) = delete;
+    Job &operator=(const Job &) = delete;
+    // the progress of the job is printed every interval, probe(rng) estimates the size of its whole tree
+    template <class _P>
+    void report(std::chrono::milliseconds interval, const _P &probe) {
+        _interval = interval;
+        _probe = probe;
+    }
+    void add_nodes(uint64_t n) {
+        _nodes.fetch_add(n, std::memory_order_relaxed);
+    }
+private:
+    friend class Scheduler;
+
+    static constexpr size_t MAX_EXTRA_DEPTH = 3;
+
+    size_t      _depth;
+    size_t      _split_depth;
+    std::string _letters;
+    Result      &_result;
+    std::function<void(size_t, const Work &)>   _search;
+    std::atomic<size_t>     _pending;
+    std::atomic<size_t>     _started;
+    std::atomic<uint64_t>   _nodes;
+    std::chrono::milliseconds   _interval;
+    std::function<double(std::mt19937_64 &)>    _probe;
+};
+
+// Work stealing pool which runs the jobs of one or more tasks. Every worker owns a deque of works: it takes
+// the last one (depth first) and others steal the first ones (the shortest prefixes, which hold the most work).
+// The prefixes are generated lazily: a prefix shorter than the depth of its job is split into its continuations
+// when it is taken, and a longer one too, as long as some workers are idle and the split depth is not reached.
+// When there is nothing left to steal, running searches donate their untried siblings.
+// A work moves between the deques, the running ones and its successors under the shared state lock,
+// so pending() sees every work of a job once, although it only holds the workers for a copy
+class Scheduler {
+public:
+    Scheduler(size_t workers):
+    _workers(workers), _threads(), _queued(0), _idle(0), _next(0),
+    _stop(false), _printed(std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < workers; ++i) {
+            _threads.emplace_back([this, i]() {
+                Work w{};
+                while (next(i, w)) {
+                    Worker &worker = _workers[i];
+                    worker.since = clock();
+                    w.job->_search(i, w);
+                    worker.busy += clock() - worker.since;
+                    worker.since = 0;
+                    {
+                        std::shared_lock<std::shared_mutex> state(_state);
+                        std::lock_guard<std::mutex> lock(_workers[i].mtx);
+                        _workers[i].running.job = nullptr;
+                    }
+                    finish(*w.job);
+                }
+            });
+        }
+    }
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+    ~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto &t: _threads) {
+            t.join();
+        }
+    }
+    size_t workers() const {
+        return _workers.size();
+    }
+    // searches the works on the workers, the whole search of the job if there are none.
+    // Returns when the job is over
+    void run(Job &job, std::vector<Work> works = {}) {
+        if (works.empty()) {
+            works.push_back(Work{&job, "", {}, 0, 0});
+        }
+        for (auto &w: works) {
+            w.job = &job;
+            push(_next++ % _workers.size(), std::move(w));
+        }
+        if (job._interval.count() > 0) {
+            watch(job);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mtx);
+        _done.wait(lock, [&job]() {
+            return (job._pending == 0);
+        });
+    }
+    // some workers are idle and there is nothing to steal
+    bool hungry() const {
+        return (_idle > 0) && (_queued == 0);
+    }
+    void push(size_t n, Work &&work) {
+        std::shared_lock<std::shared_mutex> state(_state);
+        enqueue(n, std::move(work));
+    }
+    // the works of the job which are queued or running, without the donated ones which are covered
+    // by a running work they have been donated from
+    std::vector<Work> pending(const Job &job) {
+        std::vector<Work> works;
+        {
+            std::unique_lock<std::shared_mutex> state(_state);
+            for (auto &w: _workers) {
+                std::lock_guard<std::mutex> lock(w.mtx);
+                for (const auto &work: w.works) {
+                    if (work.job == &job) {
+                        works.push_back(work);
+                    }
+                }
+                if (w.running.job == &job) {
+                    works.push_back(w.running);
+                }
+            }
+        }
+        std::vector<Work> result;
+        for (const auto &work: works) {
+            bool covered = std::any_of(works.begin(), works.end(), [&work](const Work &w) {
+                return (&w != &work) && covers(w, work);
+            });
+            if (!covered) {
+                result.push_back(work);
+            }
+        }
+        return result;
+    }
+private:
+    static constexpr std::chrono::milliseconds PRINT_INTERVAL{1000};
+    // the probes take at most this part of a report interval
+    static constexpr int64_t PROBE_SHARE = 50;
+
+    // busy is the time spent on finished works, since is the start of the current one (0 if idle)
+    struct Worker {
+        std::mutex          mtx;
+        std::deque<Work>    works;
+        Work                running{};
+        std::atomic<int64_t>    busy{0};
+        std::atomic<int64_t>    since{0};
+    };
+
+    static int64_t clock() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    // Waits for the job and prints its progress every interval: the nodes searched, their rate, the share
+    // of the estimated tree and the time left at the rate so far, then the busy share of every worker.
+    // The size of the tree is the mean of random probes (Knuth), which are run here in between
+    void watch(Job &job) {
+        std::mt19937_64 rng;
+        double estimate = 0;
+        size_t probes = 0;
+        int64_t start = clock();
+        int64_t last = start;
+        uint64_t last_nodes = 0;
+        std::vector<int64_t> last_busy(_workers.size());
+        for (size_t i = 0; i < _workers.size(); ++i) {
+            last_busy[i] = busy(i, start);
+        }
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (!_done.wait_for(lock, job._interval, [&job]() { return (job._pending == 0); })) {
+            lock.unlock();
+            int64_t probe_end = clock() + std::chrono::duration_cast<std::chrono::nanoseconds>(job._interval).count() / PROBE_SHARE;
+            do {
+                estimate += job._probe(rng);
+                probes++;
+            } while (clock() < probe_end);
+
+            int64_t now = clock();
+            uint64_t nodes = job._nodes.load(std::memory_order_relaxed);
+            // the probes tend to miss the rare deep subtrees, past the estimate the share and the time are unknown
+            double total = estimate / static_cast<double>(probes);
+            double rate = static_cast<double>(nodes) * 1e9 / static_cast<double>(std::max<int64_t>(now - start, 1));
+            bool known = (total > static_cast<double>(nodes)) && (rate > 0);
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(1) << "Progress: ";
+            if (known) {
+                line << (100.0 * static_cast<double>(nodes) / total) << "%";
+            }
+            else {
+                line << "?";
+            }
+            line << std::setprecision(0) << " (" << nodes << " of ~" << total << " nodes, " << probes << " probes), ";
+            line << (static_cast<double>(nodes - last_nodes) * 1e9 / static_cast<double>(std::max<int64_t>(now - last, 1))) << " nodes/s, ETA ";
+            if (known) {
+                line << ((total - static_cast<double>(nodes)) / rate) << "s";
+            }
+            else {
+                line << "?";
+            }
+            job._result.print_progress(line.str());
+
+            std::ostringstream usage;
+            usage << "Utilization:";
+            for (size_t i = 0; i < _workers.size(); ++i) {
+                int64_t b = busy(i, now);
+                usage << " t" << i << " " << (100 * (b - last_busy[i]) / std::max<int64_t>(now - last, 1)) << "%";
+                last_busy[i] = b;
+            }
+            job._result.print_progress(usage.str());
+            last = now;
+            last_nodes = nodes;
+            lock.lock();
+        }
+    }
+    // the busy time of the worker up to now
+    int64_t busy(size_t n, int64_t now) const {
+        int64_t busy = _workers[n].busy;
+        int64_t since = _workers[n].since;
+        return busy + ((since > 0) ? std::max<int64_t>(now - since, 0) : 0);
+    }
+
+    // the subtree of a holds b: b lies down the same prefix and path, past one of the siblings of a
+    static bool covers(const Work &a, const Work &b) {
+        if ((a.prefix != b.prefix) || (a.path.size() > b.path.size()) || !std::equal(a.path.begin(), a.path.end(), b.path.begin())) {
+            return false;
+        }
+        if (a.path.empty()) {
+            return !b.path.empty();
+        }
+        if (a.path.size() == b.path.size()) {
+            return (a.lo <= b.lo) && (b.hi <= a.hi) && ((a.lo != b.lo) || (a.hi != b.hi));
+        }
+        return (b.path[a.path.size()] >= a.lo) && (b.path[a.path.size()] < a.hi);
+    }
+    void enqueue(size_t n, Work &&work) {
+        work.job->_pending++;
+        {
+            std::lock_guard<std::mutex> lock(_workers[n].mtx);
+            _workers[n].works.push_back(std::move(work));
+            _queued++;
+        }
+        if (_idle > 0) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _cv.notify_all();
+        }
+    }
+    // the next work for the worker, false when the scheduler stops
+    bool next(size_t n, Work &work) {
+        for (;;) {
+            {
+                std::shared_lock<std::shared_mutex> state(_state);
+                if (take(n, work)) {
+                    size_t size = work.prefix.size();
+                    Job &job = *work.job;
+                    if (work.path.empty() && ((size < job._depth) || ((size < job._split_depth) && (_idle > 0)))) {
+                        for (auto ch = job._letters.rbegin(); ch != job._letters.rend(); ++ch) {
+                            enqueue(n, Work{&job, work.prefix + *ch, {}, 0, 0});
+                        }
+                        finish(job);
+                        continue;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(_workers[n].mtx);
+                        _workers[n].running = work;
+                    }
+                    print_state(n, work);
+                    return true;
+                }
+            }
+            std::unique_lock<std::mutex> lock(_mtx);
+            _idle++;
+            _cv.wait(lock, [this]() {
+                return _stop || (_queued > 0);
+            });
+            _idle--;
+            if (_stop) {
+                return false;
+            }
+        }
+    }
+    bool take(size_t n, Work &work) {
+        for (size_t i = 0; i < _workers.size(); ++i) {
+            Worker &w = _workers[(n + i) % _workers.size()];
+            std::lock_guard<std::mutex> lock(w.mtx);
+            if (!w.works.empty()) {
+                if (i == 0) {
+                    work = std::move(w.works.back());
+                    w.works.pop_back();
+                }
+                else {
+                    work = std::move(w.works.front());
+                    w.works.pop_front();
+                }
+                _queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+    void finish(Job &job) {
+        if (--job._pending == 0) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _done.notify_all();
+        }
+    }
+    // one line in a while, the result lock is not taken for every prefix
+    void print_state(size_t n, const Work &work) {
+        size_t started = ++work.job->_started;
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (now - _printed >= PRINT_INTERVAL) {
+            _printed = now;
+            work.job->_result.print_state(n, work.prefix, started, started + work.job->_pending - 1);
+        }
+    }
+
+    std::vector<Worker>         _workers;
+    std::vector<std::thread>    _threads;
+    std::atomic<size_t>     _queued;
+    std::atomic<size_t>     _idle;
+    std::atomic<size_t>     _next;
+    bool                    _stop;
+    std::chrono::steady_clock::time_point   _printed;
+    std::shared_mutex       _state;
+    std::mutex              _mtx;
+    std::condition_variable _cv;
+    std::condition_variable _done;
+};
+
 template <class _Matcher>
 class Search {
 public:
-    Search(const _Matcher &matcher, const Dictionary &dict, Result &result, const std::string &cipher, bool odd_mode, bool use_comma_start, bool use_comma_inside, char filler):
-    _matcher(matcher), _dict(dict), _result(result), _clear_fixed(), _clear(),
+    Search(const _Matcher &matcher, const Dictionary &dict, const Dictionary_View *view, Result &result, const std::string &cipher, bool odd_mode, bool use_comma_start, bool use_comma_inside, char filler):
+    _matcher(matcher), _dict(dict), _view(view), _ranges((view != nullptr) ? view->word_ranges() : dict.word_ranges()),
+    _result(result), _clear_fixed(), _clear(),
     _score(0), _score_category(0), _score_other(0),
     _cipher(cipher),
-    _odd_mode(odd_mode), _use_comma_start(use_comma_start), _use_comma_inside(use_comma_inside), _filler(filler)
+    _odd_mode(odd_mode), _use_comma_start(use_comma_start), _use_comma_inside(use_comma_inside), _filler(filler),
+    _scheduler(nullptr), _worker(0), _work(nullptr), _path(), _frames(), _bottom(0),
+    _nodes(0), _rng(nullptr), _pick(ANY), _weight(1), _estimate(0), _probe_limit(0),
+    _limit(NO_LIMIT), _bounds()
     {
     }
+    // lets the search donate its untried siblings to the idle workers of the scheduler
+    void attach(Scheduler &scheduler, size_t worker) {
+        _scheduler = &scheduler;
+        _worker = worker;
+    }
     void operator()(const std::string &fixed) {
+        run(fixed);
+    }
+    const std::string &letters() const {
+        return _dict.letters();
+    }
+    // searches a work of the scheduler, the prefix of the work follows the fixed beginning
+    void operator()(const std::string &fixed, const Work &work) {
+        _work = &work;
+        _nodes = 0;
+        run(fixed + work.prefix);
+        work.job->add_nodes(_nodes % NODE_BATCH);
+        _work = nullptr;
+    }
+    // A random probe of the tree (Knuth): it follows one alternative of every branch point, picked at random
+    // among the k of them, which stands for all of them with k times the weight. The weights of the nodes
+    // it visits estimate the number of nodes of the whole search
+    double probe(const std::string &fixed, std::mt19937_64 &rng) {
+        _rng = &rng;
+        _weight = 1;
+        _estimate = 0;
+        _pick = ANY;
+        _probe_limit = _nodes + MAX_PROBE_NODES;
+        run(fixed);
+        _rng = nullptr;
+        return _estimate;
+    }
+#ifdef PLAYFAIR_COUNTERS
+    const Counters &counters() const {
+        return _counters;
+    }
+#endif
+    static constexpr score_t NO_BOUND = std::numeric_limits<score_t>::max();
+    using Bounds = std::array<score_t, 256>;
+
+    // A step of a best-first search: searches the states of the fixed beginning one symbol deeper only,
+    // and gives for every next symbol the lowest score its states reach, which bounds the scores of
+    // all their continuations. NO_BOUND marks the symbols which cannot follow
+    void expand(const std::string &fixed, Bounds &bounds) {
+        _bounds.fill(NO_BOUND);
+        if (_odd_mode && fixed.empty()) {
+            // the first symbol only selects a subtree, it is never pushed to the cleartext
+            for (char ch = 'a'; ch <= 'z'; ++ch) {
+                _bounds[static_cast<unsigned char>(ch)] = 0;
+            }
+            bounds = _bounds;
+            return;
+        }
+        _limit = _odd_mode ? fixed.size() : fixed.size() + 1;
+        run(fixed);
+        _limit = NO_LIMIT;
+        bounds = _bounds;
+    }
+private:
+    static constexpr size_t MAX_DONATION_DEPTH = 8;
+    // the nodes are added to the job in batches, a probe stops at its limit
+    static constexpr uint64_t NODE_BATCH = 1 << 12;
+    static constexpr uint64_t MAX_PROBE_NODES = 1 << 14;
+    static constexpr uint32_t ANY = std::numeric_limits<uint32_t>::max();
+    static constexpr size_t NO_LIMIT = std::numeric_limits<size_t>::max();
+
+    // the children of the frame at the path which are not tried yet are next..hi - 1
+    struct Frame {
+        size_t      path;
+        uint32_t    next;
+        uint32_t    *hi;
+    };
+
+    void run(const std::string &fixed) {
+#ifdef PLAYFAIR_COUNTERS
+        Counters::current() = &_counters;
+#endif
         _clear_fixed = fixed;
+        _bottom = _clear_fixed.size();
 
         if (_use_comma_start) {
             _words.emplace_back(COMMA, 0, 0, 0);
@@ -200,11 +699,16 @@ public:
                 _clear_fixed = _clear_fixed.substr(1);
             }
 
-            const Word_Ngram_Tree &ngt = _dict.word_ngram_tree();
-            const Prefix_Tree &tree = _use_comma_start ? ngt.find(COMMA)->tree() : ngt.tree();
+            const Frozen_Ngram_Tree &ngt = _dict.word_ngram_tree();
+            const Frozen_Tree &tree = _use_comma_start ? ngt.find(COMMA)->tree() : ngt.tree();
+            if (_rng != nullptr) {
+                pick_child(tree, (first == Prefix_Tree::EMPTY) ? ~0u : symbol_bit(first), 0, static_cast<uint32_t>(tree.next_char_end() - tree.next_char_begin()));
+            }
             for(auto r = tree.next_char_begin(); r != tree.next_char_end(); ++r) {
                 if ((first == Prefix_Tree::EMPTY) || (r->symbol() == first)) {
-                    _next_char(*r);
+                    branch(static_cast<uint32_t>(r - tree.next_char_begin()), [&]() {
+                        _next_char(*r);
+                    });
                 }
             }
         }
@@ -217,39 +721,147 @@ public:
         }
         _clear_fixed.clear();
     }
-private:
-    using It_Pair = std::pair<const Prefix_Tree *, const Prefix_Tree *>;
-    using Tree_Pos = std::pair<It_Pair, score_t>;
 
+    // The search is a tree of branch points, the alternatives of a branch point are numbered in the order
+    // they are tried. The path leads to the current frame, a donated work starts by following its path.
+    // Only the frames which may donate keep the path: none without a scheduler, and none below the donation depth
+    bool replaying() const {
+        return (_work != nullptr) && (_path.size() < _work->path.size());
+    }
+    template <class _F>
+    void branch(uint32_t alt, const _F &f) {
+        if (_rng != nullptr) {
+            if (((_pick == ANY) || (_pick == alt)) && (_nodes < _probe_limit)) {
+                uint32_t save = _pick;
+                f();
+                _pick = save;
+            }
+        }
+        else if ((_scheduler == nullptr) || (!replaying() && (_clear.size() >= _bottom + MAX_DONATION_DEPTH))) {
+            f();
+        }
+        else if (!replaying() || (_work->path[_path.size()] == alt)) {
+            _path.push_back(alt);
+            f();
+            _path.pop_back();
+        }
+    }
+    // the alternative a probe follows at the next branch point, its weight is multiplied by k
+    void pick(uint32_t k) {
+        _pick = static_cast<uint32_t>((*_rng)() % k);
+        _weight *= k;
+    }
+    // a probe follows one of the allowed children lo..hi - 1, nothing if there are none
+    void pick_child(const Frozen_Tree &tree, uint32_t allowed, uint32_t lo, uint32_t hi) {
+        uint32_t k = 0;
+        for(uint32_t i = lo; i < hi; ++i) {
+            if (symbol_bit(tree.next_char_begin()[i].symbol()) & allowed) {
+                k++;
+            }
+        }
+        if (k == 0) {
+            _pick = hi;
+            return;
+        }
+        uint32_t n = static_cast<uint32_t>((*_rng)() % k);
+        for(uint32_t i = lo; i < hi; ++i) {
+            if ((symbol_bit(tree.next_char_begin()[i].symbol()) & allowed) && (n-- == 0)) {
+                _pick = i;
+                break;
+            }
+        }
+        _weight *= k;
+    }
+    // hands the untried siblings of the frame nearest to the bottom of the search to idle workers
+    void donate() {
+        if (!_scheduler->hungry()) {
+            return;
+        }
+        for (auto &f: _frames) {
+            if (f.next < *f.hi) {
+                auto end = _path.begin() + static_cast<std::ptrdiff_t>(f.path);
+                _scheduler->push(_worker, Work{_work->job, _work->prefix, std::vector<uint32_t>(_path.begin(), end), f.next, *f.hi});
+                *f.hi = f.next;
+                return;
+            }
+        }
+    }
+    // Words of a context which match the current prefix. A context either has its own trie, which is followed
+    // symbol by symbol, or it is compact and its records are narrowed to the ranks of the words below
+    // the current node of the primary trie
     class Set {
     public:
-        Set(const Prefix_Tree &tree, score_t other): _tree(tree), _other(other) {
+        Set(const Frozen_Ngram_Tree &ngt): _tree(ngt.has_tree() ? &ngt.tree() : nullptr), _scores(ngt.scores()),
+        _begin(0), _end((_scores != nullptr) ? _scores->size() : 0), _word(false), _other(ngt.other()) {
+        }
+        bool empty() const {
+            return (_tree != nullptr) ? _tree->empty() : (_begin == _end);
         }
-        const Prefix_Tree &tree() const {
-            return _tree;
+        bool is_word() const {
+            return (_tree != nullptr) ? _tree->is_word() : _word;
+        }
+        score_t score() const {
+            return (_tree != nullptr) ? _tree->score() : _scores->score(_begin);
+        }
+        score_t min_score() const {
+            return (_tree != nullptr) ? _tree->min_score() : _scores->min_score(_begin, _end);
         }
         score_t other() const {
             return _other;
         }
-        Tree_Pos to_tree_pos() const {
-            return {{_tree.next_char_begin(), _tree.next_char_end()}, _other};
+        // follows the symbol to the child of the primary trie, false if no word of the context is left
+        bool next(char symbol, const Frozen_Tree &primary_child, const Word_Ranges &ranges) {
+            if (_tree != nullptr) {
+                _tree = _tree->find_sub_tree(symbol);
+                return (_tree != nullptr);
+            }
+            if (_begin == _end) {
+                return false;
+            }
+            const Word_Range &r = ranges(primary_child);
+            std::tie(_begin, _end) = _scores->narrow(_begin, _end, r);
+            _word = primary_child.is_word() && (_begin < _end) && (_scores->ranks()[_begin] == r.lo);
+            return (_begin < _end);
         }
     private:
-        const Prefix_Tree &_tree;
-        score_t _other;
+        const Frozen_Tree   *_tree;
+        const Word_Scores   *_scores;
+        size_t              _begin;
+        size_t              _end;
+        bool                _word;
+        score_t             _other;
     };
     bool push_clear(char ch) {
         if ((_clear.size() < _clear_fixed.size()) && (_clear_fixed[_clear.size()] != Prefix_Tree::EMPTY) && (ch != _clear_fixed[_clear.size()])) {
             return false;
         }
         if (_matcher.push(_clear, _cipher, ch)) {
+            COUNT(push_accepted);
             _clear.push_back(ch);
+            count_node();
             return true;
         }
         else {
+            COUNT(push_rejected);
             return false;
         }
     }
+    // symbols which may be pushed at the current position
+    uint32_t allowed_symbols() const {
+        if ((_clear.size() < _clear_fixed.size()) && (_clear_fixed[_clear.size()] != Prefix_Tree::EMPTY)) {
+            return symbol_bit(_clear_fixed[_clear.size()]);
+        }
+        return _matcher.allowed(_clear, _cipher);
+    }
+    void count_node() {
+        ++_nodes;
+        if (_rng != nullptr) {
+            _estimate += _weight;
+        }
+        else if (((_nodes % NODE_BATCH) == 0) && (_work != nullptr)) {
+            _work->job->add_nodes(NODE_BATCH);
+        }
+    }
     void pop_clear() {
         char ch = _clear.back();
         _clear.pop_back();
@@ -257,27 +869,34 @@ private:
     }
     score_t acceptable(score_t word_score) const {
         score_t current = _score + _score_category + std::max(_score_other, word_score);
-        score_t base = _result.low_score_limit() * static_cast<score_t>(_result.low_score_area());
-        if (_clear.size() <= _result.low_score_area()) {
-            return (current <= base);
+        score_t limit = _result.low_score_limit() * static_cast<score_t>(_result.low_score_area());
+        if (_clear.size() > _result.low_score_area()) {
+            limit += _result.high_score_limit() * static_cast<score_t>(_clear.size() - _result.low_score_area());
         }
-        else {
-            score_t tail = _result.high_score_limit() * static_cast<score_t>(_clear.size() - _result.low_score_area());
-            return (current <= base + tail);
+        if (current > limit) {
+            COUNT_AT(rejected_by_depth, _clear.size());
+            return false;
         }
+        return true;
+    }
+
+    // trie of a root context for the word which starts at the current position. At the end of the text
+    // no word starts, the root is only passed to the final test
+    const Frozen_Tree &primary(const Frozen_Ngram_Tree &root) const {
+        return ((_view != nullptr) && (_clear.size() < _cipher.size())) ? _view->tree(root, _clear.size()) : root.tree();
     }
 
     word_id word_tree_rev(size_t n) const {
         return _dict.word_id_map().category(_words[_words.size() - 1 - n].id());
     }
 
-    score_t find_word_score(const Prefix_Tree &tree) {
+    score_t find_word_score(const Frozen_Tree &tree) {
         return tree.score();
     }
     template <class ..._Sets>
-    score_t find_word_score(const Prefix_Tree &tree, const Set &s, const _Sets &...tree_n) {
-        if (s.tree().is_word()) {
-            return s.tree().score();
+    score_t find_word_score(const Frozen_Tree &tree, const Set &s, const _Sets &...tree_n) {
+        if (s.is_word()) {
+            return s.score();
         }
         else {
             _score_other = std::max(_score_other, s.other());
@@ -285,13 +904,13 @@ private:
         }
     }
 
-    score_t calc_set_min_score(const Prefix_Tree &tree) {
+    score_t calc_set_min_score(const Frozen_Tree &tree) {
         return tree.min_score();
     }
     template <class ..._Sets>
-    score_t calc_set_min_score(const Prefix_Tree &tree, const Set &s, const _Sets &...tree_n) {
-        if (!s.tree().empty()) {
-            return s.tree().min_score();
+    score_t calc_set_min_score(const Frozen_Tree &tree, const Set &s, const _Sets &...tree_n) {
+        if (!s.empty()) {
+            return s.min_score();
         }
         else {
             return calc_set_min_score(tree, tree_n...);
@@ -300,12 +919,12 @@ private:
 
     class Best_Scores {
     public:
-        Best_Scores(const Word_Ngram_Tree &t):
+        Best_Scores(const Frozen_Ngram_Tree &t):
         proper((t.proper_hits() > 0), t.proper_score()),
         numeric((t.numeric_hits() > 0), t.numeric_score()),
         comma((t.comma_hits() > 0), t.comma_score()) {
         }
-        Best_Scores(const Best_Scores &that, const Word_Ngram_Tree &t):
+        Best_Scores(const Best_Scores &that, const Frozen_Ngram_Tree &t):
         proper(that.proper.first || (t.proper_hits() > 0), that.proper.first ? that.proper.second : std::max(that.proper.second, t.proper_score())),
         numeric(that.numeric.first || (t.numeric_hits() > 0), that.numeric.first ? that.numeric.second : std::max(that.numeric.second, t.numeric_score())),
         comma(that.comma.first || (t.comma_hits() > 0), that.comma.first ? that.comma.second : std::max(that.comma.second, t.comma_score())) {
@@ -314,18 +933,20 @@ private:
     };
 
     template <size_t _K, size_t _N, class ..._Sets>
-    Best_Scores next_char_tree(const Prefix_Tree &tree, const Word_Ngram_Tree &ngram_tree, const _Sets &...tree_n) {
+    Best_Scores next_char_tree(uint32_t alt, const Frozen_Tree &tree, const Frozen_Ngram_Tree &ngram_tree, const _Sets &...tree_n) {
         if constexpr(_K < _N) {
-            const Word_Ngram_Tree *ngt = (_words.size() > _K) ? ngram_tree.find(word_tree_rev(_K)) : nullptr;
+            const Frozen_Ngram_Tree *ngt = (_words.size() > _K) ? ngram_tree.find(word_tree_rev(_K)) : nullptr;
             if (ngt != nullptr) {
-                Set s(ngt->tree(), ngt->other());
-                auto p = next_char_tree<_K + 1, _N>(tree, *ngt, s, tree_n...);
+                Set s(*ngt);
+                auto p = next_char_tree<_K + 1, _N>(alt, tree, *ngt, s, tree_n...);
                 return Best_Scores(p, ngram_tree);
             }
             else {
                 score_t w = calc_set_min_score(tree, tree_n...);
                 if (acceptable(w)) {
-                    next_char(tree, tree_n...);
+                    branch(alt, [&]() {
+                        next_char(tree, tree_n...);
+                    });
                 }
                 return Best_Scores(ngram_tree);
             }
@@ -333,7 +954,9 @@ private:
         else {
             score_t w = calc_set_min_score(tree, tree_n...);
             if (acceptable(w)) {
-                next_char(tree, tree_n...);
+                branch(alt, [&]() {
+                    next_char(tree, tree_n...);
+                });
             }
             return Best_Scores(ngram_tree);
         }
@@ -342,35 +965,44 @@ private:
         score_t save_other = _score_other;
         score_t save_category = _score_category;
 
-        const Word_Ngram_Tree &nt = _dict.word_ngram_tree();
-        const Word_Ngram_Tree &pt = _dict.proper_tree();
-        const Word_Ngram_Tree &ut = _dict.numeric_tree();
+        const Frozen_Ngram_Tree &nt = _dict.word_ngram_tree();
+        const Frozen_Ngram_Tree &pt = _dict.proper_tree();
+        const Frozen_Ngram_Tree &ut = _dict.numeric_tree();
         _score_other = 0;
+        bool comma = _use_comma_inside || (_clear.size() + 1 >= _cipher.size());
+        uint32_t save_pick = _pick;
+        double save_weight = _weight;
+        if (_rng != nullptr) {
+            pick(comma ? 4 : 3);
+        }
 
         _score_category = 0;
-        Best_Scores s = next_char_tree<0, 5>(nt.tree(), nt);
+        Best_Scores s = next_char_tree<0, 5>(0, primary(nt), nt);
 
         _score_category = s.proper.second;
-        next_char_tree<0, 1>(pt.tree(), pt);
+        next_char_tree<0, 1>(1, primary(pt), pt);
 
         _score_category = s.numeric.second;
-        next_char_tree<0, 1>(ut.tree(), ut);
+        next_char_tree<0, 1>(2, primary(ut), ut);
 
-        if (_use_comma_inside || (_clear.size() + 1 >= _cipher.size())) {
+        if (comma) {
+            COUNT(comma_branches);
             _score_category = 0;
             _score += s.comma.second;
             _words.emplace_back(COMMA, s.comma.second, 0, 0);
-            next_char_tree<0, 5>(nt.tree(), nt);
+            next_char_tree<0, 5>(3, primary(nt), nt);
             _words.pop_back();
             _score -= s.comma.second;
         }
 
+        _pick = save_pick;
+        _weight = save_weight;
         _score_category = save_category;
         _score_other = save_other;
     }
 
     template <class ..._Sets>
-    void next_word(const Prefix_Tree &tree, const _Sets &...tree_n) {
+    void next_word(const Frozen_Tree &tree, const _Sets &...tree_n) {
         score_t save_other = _score_other;
 
         score_t word_score = find_word_score(tree, tree_n...);
@@ -379,7 +1011,9 @@ private:
             _score += _score_category + w;
             _words.emplace_back(tree.word(), word_score, _score_category, _score_other);
 
-            _result.test_better(_clear, _score, _matcher, _words);
+            if (!replaying() && (_rng == nullptr)) {
+                _result.test_better(_clear, _score, _matcher, _words);
+            }
             _next_word();
 
             _words.pop_back();
@@ -388,104 +1022,153 @@ private:
         _score_other = save_other;
     }
 
-    template <size_t _N, class ..._Sets>
-    void _test(const std::array<Tree_Pos, _N> &, char, const Prefix_Tree &tree, const _Sets &...tree_n) {
+    template <class ..._Sets>
+    void _test(const Frozen_Tree &tree, const _Sets &...tree_n) {
+        // the tests are not counted in advance, a probe follows all of them
+        uint32_t save_pick = _pick;
+        _pick = ANY;
+        uint32_t alt = 0;
         _matcher.test(_clear, _cipher, [&](){
-            next_char(tree, tree_n...);
+            branch(alt++, [&]() {
+                next_char(tree, tree_n...);
+            });
         });
+        _pick = save_pick;
     }
 
     template <size_t _K, size_t _N, class ..._Sets>
-    void next_char_fixed(const std::array<Tree_Pos, _N> &it, char symbol, const Prefix_Tree &tree, const _Sets &...tree_n) {
+    void next_char_fixed(char symbol, const Frozen_Tree &tree, const _Sets &...tree_n) {
         if constexpr(_K < _N) {
-            _next_char_fixed<_K, _N>(it, symbol, tree, tree_n...);
+            _next_char_fixed<_K, _N>(symbol, tree, tree_n...);
         }
         else {
             score_t word_score = calc_set_min_score(tree, tree_n...);
             if (acceptable(word_score)) {
-                _test<_N>(it, symbol, tree, tree_n...);
+                _test(tree, tree_n...);
             }
         }
     }
 
     template <size_t _K, size_t _N, class ..._Sets>
-    void _next_char_fixed(const std::array<Tree_Pos, _N> &it, char symbol, const Prefix_Tree &tree, const Set &s, const _Sets &...tree_n) {
-        const It_Pair &w = it[_K].first;
-        if ((w.first != w.second) && (w.first->symbol() == symbol)) {
-            Set ns(*w.first, s.other());
-            next_char_fixed<_K + 1, _N>(it, symbol, tree, tree_n..., ns);
+    void _next_char_fixed(char symbol, const Frozen_Tree &tree, const Set &s, const _Sets &...tree_n) {
+        Set ns(s);
+        if (ns.next(symbol, tree, _ranges)) {
+            next_char_fixed<_K + 1, _N>(symbol, tree, tree_n..., ns);
         }
         else {
             score_t save = _score_other;
             _score_other = std::max(_score_other, s.other());
-            next_char_fixed<_K + 1, _N>(it, symbol, tree, tree_n...);
+            next_char_fixed<_K + 1, _N>(symbol, tree, tree_n...);
             _score_other = save;
         }
     }
 
     template <class ..._Sets>
-    auto create_subtree_iters(const _Sets &...tree_n) const {
-        std::array<Tree_Pos, sizeof...(_Sets)> arr = {tree_n.to_tree_pos()...};
-        return arr;
-    }
-    template <class _Arr>
-    void move_iters(_Arr &arr, char ch) const {
-        for(auto &p: arr) {
-            It_Pair &w = p.first;
-            while ((w.first != w.second) && (w.first->symbol() < ch)) {
-                ++w.first;
-            }
-        }
-    }
-
-    template <class ..._Sets>
-    void _next_char(const Prefix_Tree &tree, const _Sets &...tree_n) {
+    void _next_char(const Frozen_Tree &tree, const _Sets &...tree_n) {
         if (_clear.size() < _cipher.size()) {
-            auto it = create_subtree_iters(tree_n...);
-            for(auto r = tree.next_char_begin(); r != tree.next_char_end(); ++r) {
-                if (push_clear(r->symbol())) {
-                    move_iters(it, r->symbol());
-                    next_char_fixed<0, sizeof...(_Sets)>(it, r->symbol(), *r, tree_n...);
-                    pop_clear();
+            uint32_t allowed = allowed_symbols();
+            if ((tree.mask() & allowed) == 0) {
+                return;
+            }
+            // the children are the alternatives, only some of them if the siblings were donated
+            uint32_t lo = 0;
+            uint32_t hi = static_cast<uint32_t>(tree.next_char_end() - tree.next_char_begin());
+            if ((_work != nullptr) && !_work->path.empty() && (_path.size() == _work->path.size())) {
+                lo = _work->lo;
+                hi = _work->hi;
+                _bottom = _clear.size();
+            }
+            uint32_t save_pick = _pick;
+            double save_weight = _weight;
+            if (_rng != nullptr) {
+                pick_child(tree, allowed, lo, hi);
+            }
+            bool donor = (_scheduler != nullptr) && !replaying() && (_clear.size() < _bottom + MAX_DONATION_DEPTH);
+            if (donor) {
+                _frames.push_back(Frame{_path.size(), lo, &hi});
+            }
+            for(uint32_t i = lo; i < hi; ++i) {
+                const Frozen_Tree &r = tree.next_char_begin()[i];
+                if (symbol_bit(r.symbol()) & allowed) {
+                    if (donor) {
+                        _frames.back().next = i + 1;
+                        donate();
+                    }
+                    branch(i, [&]() {
+                        if (push_clear(r.symbol())) {
+                            next_char_fixed<0, sizeof...(_Sets)>(r.symbol(), r, tree_n...);
+                            pop_clear();
+                        }
+                    });
                 }
             }
+            if (donor) {
+                _frames.pop_back();
+            }
+            _pick = save_pick;
+            _weight = save_weight;
         }
         else if (tree.is_root()) {
-            if (!_words.empty() && (_words.back().id() == COMMA)) {
+            if (!_words.empty() && (_words.back().id() == COMMA) && (_rng == nullptr)) {
                 _result.test_best(_clear, _score, _matcher, _words);
             }
         }
     }
 
     template <class ..._Sets>
-    void next_char(const Prefix_Tree &tree, const _Sets &...tree_n) {
-        if (tree.is_word()) {
-            next_word(tree, tree_n...);
-        }
-        else if ((_filler != Prefix_Tree::EMPTY) && (_clear.size() % 2 == 1) && push_clear('x')) { // try insert x
-            char last = _clear[_clear.size() - 2];
-            if (_clear.size() >= _cipher.size()) {
-                _matcher.test(_clear, _cipher, [&](){
-                    next_char(tree, tree_n...);
-                });
+    void next_char(const Frozen_Tree &tree, const _Sets &...tree_n) {
+        if (_clear.size() >= _limit) {
+            score_t w = calc_set_min_score(tree, tree_n...);
+            score_t &bound = _bounds[static_cast<unsigned char>(_clear[_limit - 1])];
+            bound = std::min(bound, _score + _score_category + std::max(_score_other, w));
+            return;
+        }
+        uint32_t save_pick = _pick;
+        double save_weight = _weight;
+        if (_rng != nullptr) {
+            if (tree.is_word() || ((_filler != Prefix_Tree::EMPTY) && (_clear.size() % 2 == 1))) {
+                pick(2);
             }
-            else if (push_clear(last)) {
-                const Prefix_Tree *t = tree.find_sub_tree(last);
-                if (t != nullptr) {
-                    auto it = create_subtree_iters(tree_n...);
-                    move_iters(it, last);
-                    next_char_fixed<0, sizeof...(_Sets)>(it, last, *t, tree_n...);
-                }
-                pop_clear();
+            else {
+                _pick = 1;
             }
-            pop_clear();
         }
-        _next_char(tree, tree_n...);
+        if (tree.is_word()) {
+            branch(0, [&]() {
+                next_word(tree, tree_n...);
+            });
+        }
+        else if ((_filler != Prefix_Tree::EMPTY) && (_clear.size() % 2 == 1)) {
+            branch(0, [&]() {
+                if (push_clear('x')) { // try insert x
+                    COUNT(filler_insertions);
+                    char last = _clear[_clear.size() - 2];
+                    if (_clear.size() >= _cipher.size()) {
+                        _test(tree, tree_n...);
+                    }
+                    else {
+                        const Frozen_Tree *t = tree.find_sub_tree(last);
+                        if ((t != nullptr) && push_clear(last)) {
+                            next_char_fixed<0, sizeof...(_Sets)>(last, *t, tree_n...);
+                            pop_clear();
+                        }
+                    }
+                    pop_clear();
+                }
+            });
+        }
+        branch(1, [&]() {
+            _next_char(tree, tree_n...);
+        });
+        _pick = save_pick;
+        _weight = save_weight;
     }
 
     _Matcher            _matcher;
 
     const Dictionary    &_dict;
+    const Dictionary_View   *_view;
+    Word_Ranges         _ranges;
     Result              &_result;
     std::string         _clear_fixed;
     std::string         _clear;
@@ -499,37 +1182,26 @@ private:
     bool                _use_comma_start;
     bool                _use_comma_inside;
     char                _filler;
-};
 
-class Queue {
-public:
-    Queue(size_t depth, Result &result): _result(result), _pos(0), _letters("taioswcbphfmdrelngyukvqxz") {
-        //std::reverse(std::begin(_letters), std::end(_letters));
-        add(depth, "");
-    }
-    std::string pop(size_t n) {
-        std::lock_guard<std::mutex> lock(_mtx);
-        if (_pos < _list.size()) {
-            _result.print_state(n, _list[_pos], _pos, _list.size());
-        }
-        return (_pos < _list.size()) ? _list[_pos++] : std::string();
-    }
-private:
-    void add(size_t n, const std::string &s) {
-        if (n > 0) {
-            for(char ch: _letters) {
-                add(n - 1, s + std::string(1, ch));
-            }
-        }
-        else {
-            _list.push_back(s);
-        }
-    }
-    Result &_result;
-    size_t      _pos;
-    std::string _letters;
-    std::vector<std::string>    _list;
-    std::mutex          _mtx;
+    Scheduler           *_scheduler;
+    size_t              _worker;
+    const Work          *_work;
+    std::vector<uint32_t>   _path;
+    std::vector<Frame>  _frames;
+    size_t              _bottom;
+
+    uint64_t            _nodes;
+    std::mt19937_64     *_rng;
+    uint32_t            _pick;
+    double              _weight;
+    double              _estimate;
+    uint64_t            _probe_limit;
+
+    size_t              _limit;
+    Bounds              _bounds;
+#ifdef PLAYFAIR_COUNTERS
+    Counters            _counters;
+#endif
 };
 
 bool option(char ch, std::string &s) {
@@ -542,19 +1214,52 @@ bool option(char ch, std::string &s) {
     }
 }
 
-size_t str_to_size(const std::string &s) {
-    return static_cast<size_t>(std::stoi(s));
+constexpr size_t MAX_SIZE_ARG = std::numeric_limits<int>::max();
+constexpr size_t MAX_THREADS_ARG = 4096;
+constexpr double MAX_SCORE_ARG = 1000;
+
+// numbers of the options come from the command line and from the clients of the server,
+// a bad one throws std::invalid_argument and the caller reports it
+size_t str_to_size(const std::string &s, size_t limit = MAX_SIZE_ARG) {
+    size_t end = 0;
+    long long n = -1;
+    try {
+        n = std::stoll(s, &end);
+    }
+    catch (const std::logic_error &) {
+    }
+    if ((n < 0) || (end != s.size()) || (static_cast<unsigned long long>(n) > limit)) {
+        throw std::invalid_argument("bad number " + s);
+    }
+    return static_cast<size_t>(n);
+}
+// a penalty per char
+score_t str_to_score(const std::string &s) {
+    size_t end = 0;
+    double d = -1;
+    try {
+        d = std::stod(s, &end);
+    }
+    catch (const std::logic_error &) {
+    }
+    // also false for nan
+    if (!((d >= 0) && (d <= MAX_SCORE_ARG)) || (end != s.size())) {
+        throw std::invalid_argument("bad penalty " + s);
+    }
+    return static_cast<score_t>(d * WORD_SCORE_UNIT);
 }
 
 class Task {
 public:
     Task(size_t low_score_area, score_t low_score_limit,  score_t high_score_limit,
-    size_t iterations, size_t threads, size_t queue_size,
+    score_t deepening_step, size_t wanted_solutions, size_t time_budget, size_t open_width,
+    size_t iterations, size_t threads, size_t queue_size, size_t progress_interval,
     size_t matrix_creation_point, bool odd_mode, bool use_comma_start, bool use_comma_inside, char filler,
     size_t print_solutions,
     const std::string &cipher, const std::string &clear_fixed):
     _low_score_area(low_score_area), _low_score_limit(low_score_limit), _high_score_limit(high_score_limit),
-    _iterations(iterations), _threads(threads), _queue_size(queue_size),
+    _deepening_step(deepening_step), _wanted_solutions(wanted_solutions), _time_budget(time_budget), _open_width(open_width),
+    _iterations(iterations), _threads(threads), _queue_size(queue_size), _progress_interval(progress_interval),
     _matrix_creation_point(matrix_creation_point), _odd_mode(odd_mode),
     _use_comma_start(use_comma_start), _use_comma_inside(use_comma_inside), _filler(filler),
     _print_solutions(print_solutions),
@@ -566,41 +1271,55 @@ public:
         }
     }
 
-    void execute(const std::string &type, const Dictionary &dict) const {
-        std::cout << std::endl;
-        if (_threads > 0) {
-            std::cout << "Threads: " << _threads << std::endl;
+    // a batch runs its tasks together on the threads of one shared pool
+    void execute(const std::string &type, const Dictionary &dict, std::ostream &out, Scheduler *pool = nullptr, Checkpoint *checkpoint = nullptr) const {
+        out << std::endl;
+        if (pool != nullptr) {
+            out << "Threads: " << pool->workers() << " (shared)" << std::endl;
         }
-        std::cout << "Ciphertext: " << _cipher << "(" << _cipher.size() << ")" << std::endl;
-        if (!_clear_fixed.empty()) {
-            std::cout << "Cleartext beginning: " << _clear_fixed << "(" << _clear_fixed.size() << ")" << std::endl;
+        else if (_threads > 0) {
+            out << "Threads: " << _threads << std::endl;
         }
-        std::cout << "Low score area: " << _low_score_area << std::endl;
-        std::cout << "Low score limit per char: " << score_to_str(_low_score_limit) << std::endl;
-        std::cout << "High score limit per char: " << score_to_str(_high_score_limit) << std::endl;
-        std::cout << "Matrix creation point: " << _matrix_creation_point << std::endl;
-        std::cout << "Start comma: " << (_use_comma_start ? "yes" : "no") << std::endl;
-        std::cout << "Inside comma: " << (_use_comma_inside ? "yes" : "no") << std::endl;
-        std::cout << "Odd mode: " << (_odd_mode ? "yes" : "no") << std::endl;
-        std::cout << "Print detalization: " << _print_solutions << std::endl;
-        std::cout << std::endl;
+        out << "Ciphertext: " << _cipher << "(" << _cipher.size() << ")" << std::endl;
+        if (!_clear_fixed.empty()) {
+            out << "Cleartext beginning: " << _clear_fixed << "(" << _clear_fixed.size() << ")" << std::endl;
+        }
+        out << "Low score area: " << _low_score_area << std::endl;
+        out << "Low score limit per char: " << score_to_str(_low_score_limit) << std::endl;
+        out << "High score limit per char: " << score_to_str(_high_score_limit) << std::endl;
+        if (_open_width > 0) {
+            out << "Best-first: " << _open_width << " open prefixes, " << _wanted_solutions << " solution(s)" << std::endl;
+        }
+        if (_deepening_step > 0) {
+            out << "Deepening: step " << score_to_str(_deepening_step) << ", " << _wanted_solutions << " solution(s)";
+            if (_time_budget > 0) {
+                out << ", " << _time_budget << "s";
+            }
+            out << std::endl;
+        }
+        out << "Matrix creation point: " << _matrix_creation_point << std::endl;
+        out << "Start comma: " << (_use_comma_start ? "yes" : "no") << std::endl;
+        out << "Inside comma: " << (_use_comma_inside ? "yes" : "no") << std::endl;
+        out << "Odd mode: " << (_odd_mode ? "yes" : "no") << std::endl;
+        out << "Print detalization: " << _print_solutions << std::endl;
+        out << std::endl;
 
-        Result result(dict.word_id_map(), _low_score_area, _low_score_limit, _high_score_limit, _print_solutions);
+        Result result(dict.word_id_map(), _low_score_area, _low_score_limit, _high_score_limit, _print_solutions, out);
 
         if (type == "playfair") {
-            search(playfair::Playfair(_matrix_creation_point), dict, result);
+            search_view(playfair::Playfair(_matrix_creation_point), dict, result, out, pool, checkpoint, key(type));
         }
         else if (type == "chaotic") {
-            search(chaotic::Chaotic(), dict, result);
+            search(chaotic::Chaotic(), dict, nullptr, result, out, pool, checkpoint, key(type));
         }
         else if (type == "simple") {
-            search(simple::Simple(), dict, result);
+            search_view(simple::Simple(), dict, result, out, pool, checkpoint, key(type));
         }
         else if (type == "pelling") {
-            search(simple::Pelling(5), dict, result);
+            search_view(simple::Pelling(5), dict, result, out, pool, checkpoint, key(type));
         }
         else if (type == "bigram") {
-            search(simple::Bigram(), dict, result);
+            search(simple::Bigram(), dict, nullptr, result, out, pool, checkpoint, key(type));
         }
         else {
             std::terminate();
@@ -608,54 +1327,236 @@ public:
 
 
         result.print_result_lists(true);
-        std::cout << std::endl;
-        std::cout << "Task finished" << std::endl;
-        std::cout << std::endl;
+#ifdef PLAYFAIR_COUNTERS
+        result.print_counters(type);
+#endif
+        out << std::endl;
+        out << "Task finished" << std::endl;
+        out << std::endl;
     }
 private:
+    // identifies the task in a checkpoint, by everything which changes its search but the limits,
+    // which every round of threshold deepening adds
+    uint64_t key(const std::string &type) const {
+        Snapshot_Key key;
+        key.add(type);
+        key.add(_cipher);
+        key.add(_clear_fixed);
+        key.add(static_cast<uint64_t>(_low_score_area));
+        key.add(static_cast<uint64_t>(_matrix_creation_point));
+        key.add(_odd_mode);
+        key.add(_use_comma_start);
+        key.add(_use_comma_inside);
+        key.add(_filler);
+        return key.value();
+    }
+
+    // Every worker searches with a copy of its own. With a checkpoint, the search starts from the parts
+    // which have been saved, and its pending works are saved while it runs
     template <class _Search>
-    void search_threaded(_Search &s, Result &result) const {
-        Queue queue(_queue_size, result);
-        auto func = [this, s, &queue](size_t n) mutable {
-            std::string w = queue.pop(n);
-            while (!w.empty()) {
-                s(_clear_fixed + w);
-                w = queue.pop(n);
-            };
-        };
-        std::vector<std::future<void>> futures;
-        for (size_t i = 0; i < _threads; ++i) {
-            futures.emplace_back(std::async(std::launch::async, func, i));
+    void search_threaded(const _Search &s, Result &result, Scheduler &scheduler, Checkpoint *checkpoint, uint64_t key, size_t iteration, std::vector<Task_State::Part> &parts) const {
+        std::vector<_Search> searches(scheduler.workers(), s);
+        for (size_t i = 0; i < searches.size(); ++i) {
+            searches[i].attach(scheduler, i);
+        }
+        Job job(_queue_size, _cipher.size() - std::min(_cipher.size(), _clear_fixed.size()), s.letters(), result, [&](size_t n, const Work &w) {
+            searches[n](_clear_fixed, w);
+        });
+        _Search probe(s);
+        if (_progress_interval > 0) {
+            job.report(std::chrono::seconds(_progress_interval), [&](std::mt19937_64 &rng) {
+                return probe.probe(_clear_fixed, rng);
+            });
+        }
+        std::vector<Work> works;
+        for (auto &p: parts) {
+            works.push_back(Work{&job, std::move(p.prefix), std::move(p.path), p.lo, p.hi});
+        }
+        parts.clear();
+        if (checkpoint != nullptr) {
+            // the pending works are taken first: a work which ends after that has added its solutions
+            // to the list before, so every solution is either in the list or in a part still to search
+            checkpoint->track(key, [&]() {
+                std::vector<Work> pending = scheduler.pending(job);
+                Task_State state{false, iteration, {}, result.best_list()};
+                for (const auto &w: pending) {
+                    state.parts.push_back(Task_State::Part{w.prefix, w.path, w.lo, w.hi});
+                }
+                return state;
+            });
+        }
+        scheduler.run(job, std::move(works));
+#ifdef PLAYFAIR_COUNTERS
+        for (const auto &w: searches) {
+            result.add_counters(w.counters());
+        }
+#endif
+        if (checkpoint != nullptr) {
+            checkpoint->update(key, Task_State{false, iteration + 1, {}, result.best_list()});
         }
-        for (auto &f: futures) {
-            f.get();
+    }
+
+    // Searches through a view of the dictionary which holds only the words the matcher may place at
+    // a position. The view is not used with a filler, an inserted x shifts the rest of a word
+    template <class _Matcher>
+    void search_view(const _Matcher &matcher, const Dictionary &dict, Result &result, std::ostream &out, Scheduler *pool, Checkpoint *checkpoint, uint64_t key) const {
+        if (_filler != Prefix_Tree::EMPTY) {
+            search(matcher, dict, nullptr, result, out, pool, checkpoint, key);
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::map<std::string, size_t> ids;
+        std::vector<size_t> classes;
+        std::vector<size_t> starts;
+        size_t length = dict.max_word_length();
+        for (size_t i = 0; i < _cipher.size(); ++i) {
+            auto r = ids.emplace(matcher.word_class(_cipher, i, length), ids.size());
+            if (r.second) {
+                starts.push_back(i);
+            }
+            classes.push_back(r.first->second);
         }
+        Dictionary_View view(dict, classes, [&](size_t cls, const std::string &prefix, char ch) {
+            return matcher.word_allowed(_cipher, starts[cls], prefix, ch);
+        });
+        auto d = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        out << "Dictionary view: " << view.node_count() << " of " << view.source_node_count() << " nodes, "
+            << view.class_count() << " classes (" << d.count() << "ms)" << std::endl;
+        search(matcher, dict, &view, result, out, pool, checkpoint, key);
     }
 
+    // A checkpointed or reported search always runs on workers, they know its pending works and progress.
+    // With threshold deepening the search is repeated with the limits widened by a step, until enough solutions
+    // are found or the time budget is spent. The cost of a round grows about geometrically with the limits,
+    // so the rounds before the last one cost a fraction of it; a round which would not end within the budget,
+    // judged by the growth of the previous ones, is not started
     template <class _Matcher>
-    void search(const _Matcher &matcher, const Dictionary &dict, Result &result) const {
-        Search<_Matcher> s(matcher, dict, result, _cipher, _odd_mode, _use_comma_start, _use_comma_inside, _filler);
+    void search(const _Matcher &matcher, const Dictionary &dict, const Dictionary_View *view, Result &result, std::ostream &out, Scheduler *pool, Checkpoint *checkpoint, uint64_t key) const {
+        Search<_Matcher> s(matcher, dict, view, result, _cipher, _odd_mode, _use_comma_start, _use_comma_inside, _filler);
+        std::unique_ptr<Scheduler> own;
+        if ((pool == nullptr) && ((_threads > 0) || (checkpoint != nullptr) || (_progress_interval > 0))) {
+            own = std::make_unique<Scheduler>(std::max<size_t>(_threads, 1));
+            pool = own.get();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        double last = 0;
+        for(size_t round = 0; ; ++round) {
+            auto round_start = std::chrono::steady_clock::now();
+            if (round > 0) {
+                out << "Round " << round << ": " << score_to_str(result.low_score_limit()) << "/" << score_to_str(result.high_score_limit()) << std::endl;
+            }
+            Snapshot_Key round_key;
+            round_key.add(key);
+            round_key.add(result.low_score_limit());
+            round_key.add(result.high_score_limit());
+            search_iterations(s, result, out, pool, checkpoint, round_key.value());
+            if ((_deepening_step == 0) || (result.solution_count() >= _wanted_solutions)) {
+                break;
+            }
+            auto now = std::chrono::steady_clock::now();
+            double time = std::chrono::duration<double>(now - round_start).count();
+            double growth = (last > 0) ? time / last : 0;
+            last = time;
+            if ((_time_budget > 0) && (std::chrono::duration<double>(now - start).count() + time * growth > static_cast<double>(_time_budget))) {
+                out << "Deepening stopped, the next round would exceed the time budget" << std::endl;
+                break;
+            }
+            result.widen(_deepening_step);
+        }
+#ifdef PLAYFAIR_COUNTERS
+        result.add_counters(s.counters());
+#endif
+    }
+
+    // Best-first search: the open prefixes are expanded in the order of the bound of their scores less the score
+    // limit at their length, so the ones which have used the least of the limit so far go first, and the
+    // search ends when enough solutions are found. Only the best prefixes are kept open, like a beam, which
+    // bounds the memory but may lose solutions. It runs on the calling thread
+    template <class _Search>
+    void best_first(_Search &s, Result &result, std::ostream &out) const {
+        auto start = std::chrono::steady_clock::now();
+        size_t depth = _cipher.size() - std::min(_cipher.size(), _clear_fixed.size());
+        std::multimap<score_t, std::string> open{{0, ""}};
+        typename _Search::Bounds bounds;
+        size_t expanded = 0;
+        while (!open.empty() && (result.solution_count() < _wanted_solutions)) {
+            std::string prefix = std::move(open.begin()->second);
+            open.erase(open.begin());
+            expanded++;
+            if (prefix.size() + 1 >= depth) {
+                // the last symbol, its solutions are tested
+                s(_clear_fixed + prefix);
+                continue;
+            }
+            s.expand(_clear_fixed + prefix, bounds);
+            for (size_t ch = 0; ch < bounds.size(); ++ch) {
+                if (bounds[ch] != _Search::NO_BOUND) {
+                    open.emplace(bounds[ch] - score_limit(result, _clear_fixed.size() + prefix.size() + 1), prefix + static_cast<char>(ch));
+                    if (open.size() > _open_width) {
+                        open.erase(std::prev(open.end()));
+                    }
+                }
+            }
+        }
+        auto d = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        out << "Best-first: " << expanded << " expanded, " << open.size() << " open (" << d.count() << "ms)" << std::endl;
+    }
+
+    // the score acceptable() allows a cleartext of the size
+    static score_t score_limit(const Result &result, size_t size) {
+        score_t limit = result.low_score_limit() * static_cast<score_t>(std::min(size, result.low_score_area()));
+        if (size > result.low_score_area()) {
+            limit += result.high_score_limit() * static_cast<score_t>(size - result.low_score_area());
+        }
+        return limit;
+    }
+
+    template <class _Search>
+    void search_iterations(_Search &s, Result &result, std::ostream &out, Scheduler *pool, Checkpoint *checkpoint, uint64_t key) const {
+        if (_open_width > 0) {
+            best_first(s, result, out);
+            return;
+        }
+        Task_State state{false, 0, {}, {}};
+        if ((checkpoint != nullptr) && checkpoint->find(key, state)) {
+            result.restore(state.solutions);
+            if (state.finished) {
+                out << "Resumed: finished" << std::endl;
+                return;
+            }
+            out << "Resumed: iteration " << state.iteration << ", " << state.parts.size() << " part(s)" << std::endl;
+        }
 
-        for(size_t i = 0; i < _iterations; ++i) {
+        for(size_t i = state.iteration; i < _iterations; ++i) {
             auto start = std::chrono::steady_clock::now();
-            if (_threads > 0) {
-                search_threaded(s, result);
+            if (pool != nullptr) {
+                search_threaded(s, result, *pool, checkpoint, key, i, state.parts);
             }
             else {
                 s(_clear_fixed);
             }
             auto v = std::chrono::steady_clock::now();
             auto d = std::chrono::duration_cast<std::chrono::milliseconds>(v - start);
-            std::cout << "i" << i << ": " << d.count() << std::endl;
+            out << "i" << i << ": " << d.count() << std::endl;
+        }
+        if (checkpoint != nullptr) {
+            checkpoint->update(key, Task_State{true, _iterations, {}, result.best_list()});
+            checkpoint->save();
         }
     }
 
     size_t _low_score_area;
     score_t _low_score_limit;
     score_t _high_score_limit;
+    score_t _deepening_step;
+    size_t _wanted_solutions;
+    size_t _time_budget;
+    size_t _open_width;
     size_t _iterations;
     size_t _threads;
     size_t _queue_size;
+    size_t _progress_interval;
     size_t _matrix_creation_point;
     bool _odd_mode;
     bool _use_comma_start;
@@ -666,111 +1567,432 @@ private:
     std::string _clear_fixed;
 };
 
-int main(int argc, char* args[]) {
-    std::vector<std::string> stat_files;
-    std::vector<std::string> nprop_files;
-    std::vector<std::string> prop_files;
-    std::vector<std::string> numeric_files;
-    std::string type;
-    char filler = Prefix_Tree::EMPTY;
-    size_t max_word_count = 100000;
-    size_t low_score_area = 16;
-    score_t low_score_limit = 0;
-    score_t high_score_limit = 0;
-    size_t iterations = 1;
-    size_t threads = 0;
-    size_t queue_size = 2;
-    size_t matrix_creation_point = 20;
-    std::string cipher;
-    std::string clear_fixed;
-    std::vector<Task> task_list;
-    bool odd_mode = false;
-    bool use_comma_start = false;
-    bool use_comma_inside = false;
-    size_t print_solutions = 1; // only solutions which update top list
-
-    for(int p = 1; p < argc; ++p) {
-        std::string w = args[p];
-        if (option('s', w)) {
-            stat_files.push_back(w);
-        }
-        else if (option('x', w)) {
-            type = w;
+// Values of the task options in effect for the ciphertexts which follow them
+class Task_Options {
+public:
+    Task_Options(): _low_score_area(16), _low_score_limit(0), _high_score_limit(0),
+    _deepening_step(0), _wanted_solutions(1), _time_budget(0), _open_width(0),
+    _iterations(1), _threads(0), _queue_size(2), _progress_interval(0), _matrix_creation_point(20),
+    _odd_mode(false), _use_comma_start(false), _use_comma_inside(false), _filler(Prefix_Tree::EMPTY),
+    _print_solutions(1) { // only solutions which update top list
+    }
+    bool parse(std::string w) {
+        if (option('a', w)) {
+            _low_score_area = str_to_size(w);
         }
-        else if (option('n', w)) {
-            nprop_files.push_back(w);
+        else if (option('l', w)) {
+            _low_score_limit = str_to_score(w);
         }
-        else if (option('p', w)) {
-            prop_files.push_back(w);
+        else if (option('h', w)) {
+            _high_score_limit = str_to_score(w);
         }
-        else if (option('u', w)) {
-            numeric_files.push_back(w);
+        else if (option('D', w)) {
+            _deepening_step = str_to_score(w);
         }
-        else if (option('a', w)) {
-            low_score_area = str_to_size(w);
+        else if (option('N', w)) {
+            _wanted_solutions = str_to_size(w);
         }
-        else if (option('l', w)) {
-            low_score_limit = static_cast<score_t>(std::stod(w) * WORD_SCORE_UNIT);
+        else if (option('T', w)) {
+            _time_budget = str_to_size(w);
         }
-        else if (option('h', w)) {
-            high_score_limit = static_cast<score_t>(std::stod(w) * WORD_SCORE_UNIT);
+        else if (option('E', w)) {
+            _open_width = str_to_size(w);
         }
         else if (option('i', w)) {
-            iterations = str_to_size(w);
+            _iterations = str_to_size(w);
         }
         else if (option('t', w)) {
-            threads = str_to_size(w);
+            _threads = (w.empty() || (w == "auto")) ? hardware_threads() : str_to_size(w, MAX_THREADS_ARG);
         }
         else if (option('q', w)) {
-            queue_size = str_to_size(w);
+            _queue_size = str_to_size(w);
         }
-        else if (option('w', w)) {
-            max_word_count = str_to_size(w);
+        else if (option('e', w)) {
+            _progress_interval = str_to_size(w);
         }
         else if (option('m', w)) {
-            matrix_creation_point = str_to_size(w);
+            _matrix_creation_point = str_to_size(w);
         }
         else if (option('c', w)) {
-            clear_fixed = to_lower(w);
+            _clear_fixed = to_lower(w);
         }
         else if (option('f', w)) {
-            filler = w[0];
+            _filler = w[0];
         }
         else if (option('O', w)) {
-            odd_mode = (w != "off");
+            _odd_mode = (w != "off");
         }
         else if (option('S', w)) {
-            use_comma_start = (w != "off");
+            _use_comma_start = (w != "off");
         }
         else if (option('C', w)) {
-            use_comma_inside = (w != "off");
+            _use_comma_inside = (w != "off");
         }
         else if (option('P', w)) {
-            print_solutions = str_to_size(w);
+            _print_solutions = str_to_size(w);
         }
         else {
-            cipher = to_lower(w);
-            task_list.emplace_back(low_score_area, low_score_limit, high_score_limit, iterations, threads, queue_size, matrix_creation_point, odd_mode, use_comma_start, use_comma_inside, filler, print_solutions, cipher, clear_fixed);
+            return false;
+        }
+        return true;
+    }
+    Task task(const std::string &cipher) const {
+        return Task(_low_score_area, _low_score_limit, _high_score_limit, _deepening_step, _wanted_solutions, _time_budget, _open_width, _iterations, _threads, _queue_size, _progress_interval, _matrix_creation_point, _odd_mode, _use_comma_start, _use_comma_inside, _filler, _print_solutions, cipher, _clear_fixed);
+    }
+private:
+    size_t _low_score_area;
+    score_t _low_score_limit;
+    score_t _high_score_limit;
+    score_t _deepening_step;
+    size_t _wanted_solutions;
+    size_t _time_budget;
+    size_t _open_width;
+    size_t _iterations;
+    size_t _threads;
+    size_t _queue_size;
+    size_t _progress_interval;
+    size_t _matrix_creation_point;
+    bool _odd_mode;
+    bool _use_comma_start;
+    bool _use_comma_inside;
+    char _filler;
+    size_t _print_solutions;
+    std::string _clear_fixed;
+};
+
+bool known_type(const std::string &type) {
+    return (type == "playfair") || (type == "chaotic") || (type == "simple") || (type == "pelling") || (type == "bigram");
+}
+// playfair joins i and j, so it needs its own dictionary
+bool uses_ji(const std::string &type) {
+    return (type == "playfair");
+}
+
+#ifndef _WIN32
+// Output buffer which sends everything to a socket, std::endl passes every line to the client at once
+class Socket_Buffer: public std::streambuf {
+public:
+    Socket_Buffer(int fd): _fd(fd), _failed(false) {
+        setp(_buffer.data(), _buffer.data() + _buffer.size());
+    }
+    ~Socket_Buffer() {
+        sync();
+    }
+protected:
+    int overflow(int ch) override {
+        if (sync() != 0) {
+            return traits_type::eof();
+        }
+        if (ch != traits_type::eof()) {
+            *pptr() = static_cast<char>(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+    int sync() override {
+        const char *p = pbase();
+        while (!_failed && (p < pptr())) {
+            ssize_t n = send(_fd, p, static_cast<size_t>(pptr() - p), 0);
+            if (n < 0) {
+                // the client has gone, the task still runs to the end
+                _failed = (errno != EINTR);
+                continue;
+            }
+            p += n;
+        }
+        setp(_buffer.data(), _buffer.data() + _buffer.size());
+        return _failed ? -1 : 0;
+    }
+private:
+    int     _fd;
+    bool    _failed;
+    std::array<char, 4096> _buffer;
+};
+
+// Keeps the dictionary loaded and runs the tasks sent over a Unix domain socket.
+// Every line is one request with the same task options and ciphertexts as the command line,
+// starting from the options given to the server. The output of the tasks is sent back as it appears.
+// Every connection is served by its own thread
+class Server {
+public:
+    Server(const std::string &path, const std::string &type, const Dictionary &dict, const Task_Options &options):
+    _path(path), _type(type), _dict(dict), _options(options) {
+    }
+    bool run() {
+        signal(SIGPIPE, SIG_IGN);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (_path.size() >= sizeof(addr.sun_path)) {
+            std::cout << "Socket path is too long: " << _path << std::endl;
+            return false;
+        }
+        std::copy(_path.begin(), _path.end(), addr.sun_path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(_path.c_str());
+        if ((fd < 0) || (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) || (listen(fd, SOMAXCONN) != 0)) {
+            std::cout << "Cannot listen on " << _path << std::endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        std::cout << "Listening on " << _path << std::endl;
+        while (true) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client >= 0) {
+                std::thread(&Server::serve, this, client).detach();
+            }
+            else if (errno != EINTR) {
+                break;
+            }
+        }
+        close(fd);
+        return true;
+    }
+private:
+    void serve(int client) {
+        {
+            Socket_Buffer buffer(client);
+            std::ostream out(&buffer);
+            std::string pending;
+            std::array<char, 4096> block;
+            ssize_t n;
+            while ((n = recv(client, block.data(), block.size(), 0)) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                pending.append(block.data(), static_cast<size_t>(n));
+                size_t p;
+                while ((p = pending.find('\n')) != std::string::npos) {
+                    execute(pending.substr(0, p), out);
+                    pending.erase(0, p + 1);
+                }
+            }
+            if (!pending.empty()) {
+                execute(pending, out);
+            }
+            out.flush();
+        }
+        close(client);
+    }
+    // a bad request is answered with an error, the server goes on
+    void execute(const std::string &line, std::ostream &out) const {
+        try {
+            execute_request(line, out);
+        }
+        catch (const std::exception &e) {
+            out << "Error: " << e.what() << std::endl;
+        }
+    }
+    void execute_request(const std::string &line, std::ostream &out) const {
+        std::istringstream args(line);
+        Task_Options options = _options;
+        std::string type = _type;
+        std::string w;
+        while (args >> w) {
+            if (option('x', w)) {
+                if (!known_type(w)) {
+                    out << "Error: unknown cipher type " << w << std::endl;
+                    return;
+                }
+                if (uses_ji(w) != uses_ji(_type)) {
+                    out << "Error: cipher type " << w << " needs another dictionary" << std::endl;
+                    return;
+                }
+                type = w;
+            }
+            else if (options.parse(w)) {
+            }
+            else if (w[0] == '-') {
+                out << "Error: unknown option " << w << std::endl;
+                return;
+            }
+            else {
+                options.task(to_lower(w)).execute(type, _dict, out);
+            }
+        }
+    }
+
+    std::string         _path;
+    std::string         _type;
+    const Dictionary    &_dict;
+    Task_Options        _options;
+};
+#endif
+
+int main(int argc, char* args[]) {
+    std::vector<std::string> stat_files;
+    std::vector<std::string> nprop_files;
+    std::vector<std::string> prop_files;
+    std::vector<std::string> numeric_files;
+    std::string type;
+    size_t max_word_count = 100000;
+    bool compact = false;
+    size_t prefetch_order = 0;
+    hits_t min_hits = 0;
+    size_t top_k = 0;
+    std::string cache_dir = ".";
+    std::string socket_path;
+    size_t batch_threads = 0;
+    std::string checkpoint_file;
+    size_t checkpoint_interval = 60;
+    Task_Options options;
+    std::vector<Task> task_list;
+
+    std::deque<std::string> words(args + 1, args + argc);
+    try {
+        while (!words.empty()) {
+            std::string w = words.front();
+            words.pop_front();
+            if (option('b', w)) {
+                // the words of a task file take its place on the command line, "#" starts a comment
+                std::ifstream file(w);
+                if (!file) {
+                    std::cout << "Cannot open task file " << w << std::endl;
+                    return 1;
+                }
+                std::vector<std::string> file_words;
+                std::string line;
+                while (std::getline(file, line)) {
+                    std::istringstream stream(line.substr(0, line.find('#')));
+                    std::string fw;
+                    while (stream >> fw) {
+                        file_words.push_back(fw);
+                    }
+                }
+                words.insert(words.begin(), file_words.begin(), file_words.end());
+            }
+            else if (option('B', w)) {
+                batch_threads = (w.empty() || (w == "auto")) ? hardware_threads() : str_to_size(w, MAX_THREADS_ARG);
+            }
+            else if (option('s', w)) {
+                stat_files.push_back(w);
+            }
+            else if (option('x', w)) {
+                type = w;
+            }
+            else if (option('n', w)) {
+                nprop_files.push_back(w);
+            }
+            else if (option('p', w)) {
+                prop_files.push_back(w);
+            }
+            else if (option('u', w)) {
+                numeric_files.push_back(w);
+            }
+            else if (option('w', w)) {
+                max_word_count = str_to_size(w);
+            }
+            else if (option('k', w)) {
+                compact = (w != "off");
+            }
+            else if (option('M', w)) {
+                min_hits = static_cast<hits_t>(str_to_size(w));
+            }
+            else if (option('K', w)) {
+                top_k = str_to_size(w);
+            }
+            else if (option('g', w)) {
+                prefetch_order = str_to_size(w);
+            }
+            else if (option('d', w)) {
+                cache_dir = (w != "off") ? w : std::string();
+            }
+            else if (option('L', w)) {
+                socket_path = w;
+            }
+            else if (option('R', w)) {
+                checkpoint_file = w;
+            }
+            else if (option('r', w)) {
+                checkpoint_interval = str_to_size(w);
+                // 0 would save in a loop
+                if (checkpoint_interval == 0) {
+                    throw std::invalid_argument("checkpoint interval below 1 second");
+                }
+            }
+            else if (options.parse(w)) {
+            }
+            else {
+                task_list.push_back(options.task(to_lower(w)));
+            }
         }
     }
+    catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (!known_type(type)) {
+        std::cout << "Unknown cipher type " << type << std::endl;
+        return 1;
+    }
     std::cout << "Cipher type: " << type << std::endl;
     std::cout << "Tasks: " << task_list.size() << std::endl;
     std::cout << "Score unit: " << WORD_SCORE_UNIT << std::endl;
     std::cout << "Max word count: " << max_word_count << std::endl;
+    std::cout << "Compact contexts: " << (compact ? "on" : "off") << std::endl;
 
     auto execute_tasks = [&](auto conv) {
-        Dictionary dict(conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count);
+        Dictionary dict(conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count, compact, min_hits, top_k, cache_dir);
+        if (!dict.ok()) {
+            std::cout << "Cannot build the dictionary" << std::endl;
+            return false;
+        }
+        if (prefetch_order > 0) {
+            dict.prefetch(prefetch_order);
+        }
+        std::unique_ptr<Checkpoint> checkpoint;
+        if (!checkpoint_file.empty()) {
+            Snapshot_Key key = Dictionary::snapshot_key(conv, stat_files, nprop_files, prop_files, numeric_files, max_word_count, compact, min_hits, top_k);
+            checkpoint = std::make_unique<Checkpoint>(checkpoint_file, key.value(), std::chrono::seconds(checkpoint_interval));
+        }
 
-        for(const Task &task: task_list) {
-            task.execute(type, dict);
+        if (batch_threads > 0) {
+            // the tasks run together, every one into its own buffer, which is printed in the order of the tasks.
+            // A few more tasks than threads are started, so the pool stays busy while a task prepares or ends
+            Scheduler pool(batch_threads);
+            std::vector<std::ostringstream> outputs(task_list.size());
+            std::deque<std::future<void>> running;
+            size_t printed = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < task_list.size(); ++i) {
+                if (running.size() > batch_threads) {
+                    running.front().get();
+                    running.pop_front();
+                    std::cout << outputs[printed++].str() << std::flush;
+                }
+                running.push_back(std::async(std::launch::async, [&, i]() {
+                    task_list[i].execute(type, dict, outputs[i], &pool, checkpoint.get());
+                }));
+            }
+            for (auto &f: running) {
+                f.get();
+                std::cout << outputs[printed++].str() << std::flush;
+            }
+            auto d = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "Batch of " << task_list.size() << " tasks: " << d.count() << "ms" << std::endl;
+        }
+        else {
+            for(const Task &task: task_list) {
+                task.execute(type, dict, std::cout, nullptr, checkpoint.get());
+            }
+        }
+        if (!socket_path.empty()) {
+#ifndef _WIN32
+            Server(socket_path, type, dict, options).run();
+#else
+            std::cout << "Server mode is not supported on Windows" << std::endl;
+#endif
         }
+        return true;
     };
 
-    if (type == "playfair") {
-        execute_tasks(Converter_JI());
-    }
-    else {
-        execute_tasks(Common_Converter());
+    bool ok = uses_ji(type) ? execute_tasks(Converter_JI()) : execute_tasks(Common_Converter());
+    if (!ok) {
+        return 1;
     }
 
     system("pause");
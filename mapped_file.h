@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+
+// Read-only view of a whole file mapped into memory. The pages are shared with the page cache,
+// nothing is copied until they are touched
+class Mapped_File {
+public:
+    Mapped_File(const std::string &filename): _data(nullptr), _size(0), _ok(false) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            _ok = false;
+        }
+        else if (size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                _data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+            _size = static_cast<size_t>(size.QuadPart);
+            _ok = (_data != nullptr);
+        }
+        else {
+            _ok = (size.QuadPart == 0);
+        }
+        CloseHandle(file);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            _ok = false;
+        }
+        else if (st.st_size > 0) {
+            void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                _data = static_cast<const char *>(p);
+                _size = static_cast<size_t>(st.st_size);
+                _ok = true;
+            }
+        }
+        else {
+            // an empty file cannot be mapped, but there is nothing to read anyway
+            _ok = (st.st_size == 0);
+        }
+        close(fd);
+#endif
+        if (!_ok) {
+            _data = nullptr;
+            _size = 0;
+        }
+    }
+    Mapped_File(const Mapped_File &) = delete;
+    Mapped_File &operator=(const Mapped_File &) = delete;
+    ~Mapped_File() {
+        if (_data != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(_data);
+#else
+            munmap(const_cast<char *>(_data), _size);
+#endif
+        }
+    }
+    // the range is about to be read from the beginning to the end
+    void sequential(size_t begin, size_t end) const {
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+        advise(begin, end, MADV_SEQUENTIAL);
+#else
+        (void)begin;
+        (void)end;
+#endif
+    }
+    // the range will be needed soon, the system reads it ahead in the background
+    void will_need(size_t begin, size_t end) const {
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+        advise(begin, end, MADV_WILLNEED);
+#else
+        (void)begin;
+        (void)end;
+#endif
+    }
+    // the range is accessed at random, only the touched pages are read in
+    void random(size_t begin, size_t end) const {
+#if !defined(_WIN32) && defined(MADV_RANDOM)
+        advise(begin, end, MADV_RANDOM);
+#else
+        (void)begin;
+        (void)end;
+#endif
+    }
+    bool ok() const {
+        return _ok;
+    }
+    const char *data() const {
+        return _data;
+    }
+    size_t size() const {
+        return _size;
+    }
+    std::string_view view() const {
+        return std::string_view(_data, _size);
+    }
+private:
+#ifndef _WIN32
+    void advise(size_t begin, size_t end, int advice) const {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        begin = begin / page * page;
+        end = std::min(end, _size);
+        if ((_data != nullptr) && (begin < end)) {
+            madvise(const_cast<char *>(_data) + begin, end - begin, advice);
+        }
+    }
+#endif
+
+    const char  *_data;
+    size_t      _size;
+    bool        _ok;
+};
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+
+// Output of a command (e.g. a decompressor) read on a thread of its own. The output is cut into blocks
+// of whole lines, so the consumer parses every block in place while the next ones are being read
+class Pipe_Reader {
+public:
+    Pipe_Reader(const std::string &command): _pipe(nullptr), _done(false), _stop(false), _ok(false) {
+#ifdef _WIN32
+        _pipe = _popen(command.c_str(), "rb");
+#else
+        _pipe = popen(command.c_str(), "r");
+#endif
+        if (_pipe != nullptr) {
+            _thread = std::thread([this]() {
+                run();
+            });
+        }
+        else {
+            _done = true;
+        }
+    }
+    Pipe_Reader(const Pipe_Reader &) = delete;
+    Pipe_Reader &operator=(const Pipe_Reader &) = delete;
+    ~Pipe_Reader() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+    // the next block, false when the output is over
+    bool next(std::string &block) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait(lock, [this]() {
+            return !_blocks.empty() || _done;
+        });
+        if (_blocks.empty()) {
+            return false;
+        }
+        block = std::move(_blocks.front());
+        _blocks.pop_front();
+        _cv.notify_all();
+        return true;
+    }
+    // the command has succeeded, valid when next() has returned false
+    bool ok() const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _ok;
+    }
+    static std::string quote(const std::string &arg) {
+#ifdef _WIN32
+        return "\"" + arg + "\"";
+#else
+        std::string result = "'";
+        for (char ch: arg) {
+            result += (ch == '\'') ? std::string("'\\''") : std::string(1, ch);
+        }
+        return result + "'";
+#endif
+    }
+private:
+    static constexpr size_t BLOCK_SIZE = 4 << 20;
+    static constexpr size_t MAX_BLOCKS = 4;
+
+    void run() {
+        std::string tail;
+        bool stopped = false;
+        while (!stopped) {
+            std::string block = std::move(tail);
+            tail.clear();
+            size_t n = block.size();
+            block.resize(n + BLOCK_SIZE);
+            size_t r = fread(&block[n], 1, BLOCK_SIZE, _pipe);
+            block.resize(n + r);
+            if (r == 0) {
+                if (!block.empty()) {
+                    push(std::move(block));
+                }
+                break;
+            }
+            size_t eol = block.rfind('\n');
+            if (eol == std::string::npos) {
+                tail = std::move(block);
+                continue;
+            }
+            tail = block.substr(eol + 1);
+            block.resize(eol + 1);
+            stopped = !push(std::move(block));
+        }
+#ifdef _WIN32
+        int status = _pclose(_pipe);
+#else
+        int status = pclose(_pipe);
+#endif
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _ok = !stopped && (status == 0);
+            _done = true;
+        }
+        _cv.notify_all();
+    }
+    // false if the reader is not needed anymore
+    bool push(std::string &&block) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait(lock, [this]() {
+            return (_blocks.size() < MAX_BLOCKS) || _stop;
+        });
+        if (_stop) {
+            return false;
+        }
+        _blocks.push_back(std::move(block));
+        _cv.notify_all();
+        return true;
+    }
+
+    FILE                    *_pipe;
+    std::thread             _thread;
+    mutable std::mutex      _mtx;
+    std::condition_variable _cv;
+    std::deque<std::string> _blocks;
+    bool                    _done;
+    bool                    _stop;
+    bool                    _ok;
+};
@@ -120,6 +120,7 @@ public:
         return _rev[char_to_size(ch)];
     }
     void add(size_t n, char ch) {
+        COUNT(matrix_placements);
         _val[n] = ch;
         _rev[char_to_size(ch)] = n;
     }
@@ -237,6 +238,22 @@ public:
     const std::string &key() const {
         return _matrix.val();
     }
+    // without a filler a word never doubles a letter inside of a digraph, so the words which start
+    // at an even position and the ones which start at an odd position are restricted differently
+    std::string word_class(const std::string &, size_t start, size_t) const {
+        return (start % 2 == 0) ? "even" : "odd";
+    }
+    bool word_allowed(const std::string &, size_t start, const std::string &prefix, char ch) const {
+        return prefix.empty() || ((start + prefix.size()) % 2 == 0) || (prefix.back() != ch);
+    }
+    // a letter is never encrypted to itself and never doubled inside of a digraph
+    uint32_t allowed(const std::string &clear, const std::string &cipher) const {
+        uint32_t result = ALL_SYMBOLS & ~symbol_bit(cipher[clear.size()]);
+        if (clear.size() % 2 == 1) {
+            result &= ~symbol_bit(clear.back());
+        }
+        return result;
+    }
     bool push(const std::string &clear, const std::string &cipher, char ch) {
         if (ch == cipher[clear.size()]) {
             return false;
@@ -432,6 +449,7 @@ private:
 
     template <class _F, class _N>
     void set_clear_set(const std::string &clear, const std::string &cipher, const _F &f, const _N &n) {
+        COUNT(clear_set_calls);
         clear_char_info();
         _units_sorted.clear();
         for(const Char_Unit &u: _units) {
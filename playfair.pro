@@ -11,11 +11,20 @@ QMAKE_CXXFLAGS_WARN_ON += \
     -Wconversion \
     -Wsign-conversion
 
+# counters of the search hot paths, printed as JSON at the end of every task
+# DEFINES += PLAYFAIR_COUNTERS
+
 SOURCES += \
     main.cpp
 
 HEADERS += \
+    snapshot.h \
+    arena.h \
+    mapped_file.h \
+    pipe_reader.h \
+    counters.h \
     dict.h \
+    checkpoint.h \
     simple.h \
     playfair.h \
     chaotic.h
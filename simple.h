@@ -8,6 +8,37 @@ size_t char_to_size(char ch) {
     return static_cast<size_t>(ch);
 }
 
+// Pattern of the repetitions of a text, e.g. "letter" -> "abccbd". Only the letters at a distance of
+// a multiple of the period are compared, the other ones are always different
+std::string pattern(const std::string &s, size_t period) {
+    std::string result;
+    size_t count = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        size_t k = i % period;
+        while ((k < i) && (s[k] != s[i])) {
+            k += period;
+        }
+        result.push_back((k < i) ? result[k] : static_cast<char>('a' + count++));
+    }
+    return result;
+}
+
+// ch may follow the prefix of a word which starts at the position of the ciphertext, if the pattern
+// of the word stays the one of the ciphertext: equal letters are substituted by equal letters
+// and different ones by different ones
+bool fits_pattern(const std::string &cipher, size_t start, size_t period, const std::string &prefix, char ch) {
+    size_t i = start + prefix.size();
+    if (i >= cipher.size()) {
+        return false;
+    }
+    for (size_t k = prefix.size() % period; k < prefix.size(); k += period) {
+        if ((cipher[start + k] == cipher[i]) != (prefix[k] == ch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 template <class _Symbol>
 class Reference {
 public:
@@ -26,6 +57,9 @@ public:
     bool is_null() const {
         return (_counter == 0);
     }
+    const _Symbol &symbol() const {
+        return _symbol;
+    }
 private:
     _Symbol    _symbol;
     size_t  _counter;
@@ -39,6 +73,18 @@ public:
     std::string key() const {
         return "";
     }
+    // the words which start at a position fit the pattern of the ciphertext there, up to the length
+    // of the longest word, so the positions which look alike locally share a class
+    std::string word_class(const std::string &cipher, size_t start, size_t length) const {
+        return pattern(cipher.substr(start, length), 1);
+    }
+    bool word_allowed(const std::string &cipher, size_t start, const std::string &prefix, char ch) const {
+        return fits_pattern(cipher, start, 1, prefix, ch);
+    }
+    uint32_t allowed(const std::string &clear, const std::string &cipher) const {
+        const Reference<char> &r = _inv[char_to_size(cipher[clear.size()])];
+        return r.is_null() ? ALL_SYMBOLS : symbol_bit(r.symbol());
+    }
     bool push(const std::string &clear, const std::string &cipher, char ch) {
         char w = cipher[clear.size()];
         bool a = _sub[char_to_size(ch)].is_compatible(w);
@@ -74,6 +120,16 @@ public:
     std::string key() const {
         return "";
     }
+    uint32_t allowed(const std::string &clear, const std::string &cipher) const {
+        if (clear.size() % 2 == 0) {
+            return ALL_SYMBOLS;
+        }
+        const Reference<Symbol_Type> &r = _inv[char_to_size(cipher[clear.size() - 1])][char_to_size(cipher[clear.size()])];
+        if (r.is_null()) {
+            return ALL_SYMBOLS;
+        }
+        return (r.symbol().first == clear.back()) ? symbol_bit(r.symbol().second) : 0;
+    }
     bool push(const std::string &clear, const std::string &cipher, char ch) {
         if (clear.size() % 2 == 0) {
             return true;
@@ -116,6 +172,18 @@ public:
     std::string key() const {
         return "";
     }
+    // a letter is substituted by the alphabet of its position, so only the letters at a distance
+    // of a multiple of the count make a pattern
+    std::string word_class(const std::string &cipher, size_t start, size_t length) const {
+        return pattern(cipher.substr(start, length), _count);
+    }
+    bool word_allowed(const std::string &cipher, size_t start, const std::string &prefix, char ch) const {
+        return fits_pattern(cipher, start, _count, prefix, ch);
+    }
+    uint32_t allowed(const std::string &clear, const std::string &cipher) const {
+        const Reference<char> &r = _inv[clear.size() % _count][char_to_size(cipher[clear.size()])];
+        return r.is_null() ? ALL_SYMBOLS : symbol_bit(r.symbol());
+    }
     bool push(const std::string &clear, const std::string &cipher, char ch) {
         std::array<Reference<char>, 128> &sub = _sub[clear.size() % _count];
         std::array<Reference<char>, 128> &inv = _inv[clear.size() % _count];
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+
+constexpr uint64_t SNAPSHOT_MAGIC = 0x5443494446594c50; // "PLYFDICT"
+constexpr uint32_t SNAPSHOT_VERSION = 7;
+// the trees start at a page boundary, so they can be used right from a mapping of the file
+constexpr uint64_t SNAPSHOT_ALIGNMENT = 4096;
+
+class Snapshot_Key {
+public:
+    Snapshot_Key(): _hash(14695981039346656037ull) {
+    }
+    void add(const void *data, size_t size) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            _hash ^= p[i];
+            _hash *= 1099511628211ull;
+        }
+    }
+    void add(const std::string &s) {
+        add(s.data(), s.size());
+        add(static_cast<uint64_t>(s.size()));
+    }
+    template <class _T>
+    void add(const _T &v) {
+        static_assert(std::is_trivially_copyable<_T>::value, "POD expected");
+        add(&v, sizeof(v));
+    }
+    // path, size and modification time identify the file without reading it
+    void add_file(const std::string &filename) {
+        add(filename);
+        std::error_code ec;
+        auto size = std::filesystem::file_size(filename, ec);
+        add(static_cast<uint64_t>(ec ? 0 : size));
+        auto time = std::filesystem::last_write_time(filename, ec);
+        add(static_cast<int64_t>(ec ? 0 : time.time_since_epoch().count()));
+    }
+    uint64_t value() const {
+        return _hash;
+    }
+    std::string str() const {
+        std::stringstream stream;
+        stream << std::hex << std::setw(16) << std::setfill('0') << _hash;
+        return stream.str();
+    }
+private:
+    uint64_t    _hash;
+};
+
+class Snapshot_Writer {
+public:
+    Snapshot_Writer(const std::string &filename): _file(filename, std::ios::binary) {
+    }
+    bool ok() const {
+        return static_cast<bool>(_file);
+    }
+    void write(const void *data, size_t size) {
+        _file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+    }
+    template <class _T>
+    void write(const _T &v) {
+        static_assert(std::is_trivially_copyable<_T>::value, "POD expected");
+        write(&v, sizeof(v));
+    }
+    void write(const std::string &s) {
+        write(static_cast<uint64_t>(s.size()));
+        write(s.data(), s.size());
+    }
+    void write(const std::vector<std::string> &v) {
+        write(static_cast<uint64_t>(v.size()));
+        for (const auto &s: v) {
+            write(s);
+        }
+    }
+    void align(uint64_t alignment) {
+        uint64_t pos = static_cast<uint64_t>(_file.tellp());
+        std::vector<char> zeros(static_cast<size_t>((alignment - pos % alignment) % alignment));
+        write(zeros.data(), zeros.size());
+    }
+private:
+    std::ofstream   _file;
+};
+
+class Snapshot_Reader {
+public:
+    Snapshot_Reader(const std::string &filename): _file(filename, std::ios::binary) {
+    }
+    bool ok() const {
+        return static_cast<bool>(_file);
+    }
+    void read(void *data, size_t size) {
+        _file.read(static_cast<char *>(data), static_cast<std::streamsize>(size));
+    }
+    template <class _T>
+    void read(_T &v) {
+        static_assert(std::is_trivially_copyable<_T>::value, "POD expected");
+        read(&v, sizeof(v));
+    }
+    template <class _T>
+    _T read() {
+        _T v{};
+        read(v);
+        return v;
+    }
+    void read(std::string &s) {
+        s.resize(read_size(MAX_STRING_SIZE));
+        read(s.data(), s.size());
+    }
+    void read(std::vector<std::string> &v) {
+        v.resize(read_size(MAX_LIST_SIZE));
+        for (auto &s: v) {
+            read(s);
+        }
+    }
+    void align(uint64_t alignment) {
+        uint64_t pos = tell();
+        skip((alignment - pos % alignment) % alignment);
+    }
+    void skip(uint64_t size) {
+        _file.seekg(static_cast<std::streamoff>(size), std::ios::cur);
+    }
+    uint64_t tell() {
+        return static_cast<uint64_t>(_file.tellg());
+    }
+    size_t read_size(uint64_t max) {
+        uint64_t n = read<uint64_t>();
+        if (!ok() || (n > max)) {
+            // damaged snapshot, do not try to allocate garbage sizes
+            _file.setstate(std::ios::failbit);
+            return 0;
+        }
+        return static_cast<size_t>(n);
+    }
+private:
+    static constexpr uint64_t MAX_STRING_SIZE = 1 << 16;
+    static constexpr uint64_t MAX_LIST_SIZE = 1 << 28;
+
+    std::ifstream   _file;
+};
+
+// Exclusive lock of a snapshot which is being built. Other processes wait for it and then load the snapshot
+// instead of building their own copy. The system releases the lock if the process dies
+class Snapshot_Lock {
+public:
+    Snapshot_Lock(const std::string &filename) {
+#ifdef _WIN32
+        _file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file != INVALID_HANDLE_VALUE) {
+            OVERLAPPED o = {};
+            LockFileEx(_file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &o);
+        }
+#else
+        _fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd >= 0) {
+            flock(_fd, LOCK_EX);
+        }
+#endif
+    }
+    Snapshot_Lock(const Snapshot_Lock &) = delete;
+    Snapshot_Lock &operator=(const Snapshot_Lock &) = delete;
+    ~Snapshot_Lock() {
+#ifdef _WIN32
+        if (_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(_file);
+        }
+#else
+        if (_fd >= 0) {
+            close(_fd);
+        }
+#endif
+    }
+private:
+#ifdef _WIN32
+    HANDLE  _file;
+#else
+    int     _fd;
+#endif
+};
@@ -0,0 +1,641 @@
+/*
+ * Copyright (c) Konstantin Hamidullin. All rights reserved.
+ */
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <array>
+#include <set>
+#include <map>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <string>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <assert.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <snapshot.h>
+#include <arena.h>
+#include <mapped_file.h>
+#include <pipe_reader.h>
+#include <dict.h>
+
+// Builds a stats file for -s from plain text corpora. Every n-gram of 1..MAX_ORDER tokens is counted,
+// the counts are written as a tree of prefixes: "+word hits" opens the n-grams which start with
+// the prefix, "=word hits" is an n-gram which is not continued, "-" closes the last opened prefix.
+//
+// The corpora are split into parts which are counted in parallel. Every part has its own hash maps,
+// sharded by the first word, which are spilled to disk as sorted runs when they exceed their share
+// of memory. The runs of every shard are merged separately, so memory stays bounded by -m at any corpus size.
+// Every run which is read holds a file: at most MAX_OPEN_RUNS are read at once on all threads together,
+// more runs are first merged in groups into intermediate runs
+
+constexpr size_t MAX_ORDER = 5;
+constexpr size_t SHARDS = 64;
+constexpr size_t MAX_OPEN_RUNS = 256;
+// memory of a hash map entry besides the key
+constexpr size_t ENTRY_OVERHEAD = 64;
+constexpr size_t MAX_THREADS_ARG = 4096;
+// in MB, the limit is shifted to bytes
+constexpr size_t MAX_MEMORY_ARG = size_t(1) << 24;
+
+bool option(char ch, std::string &s) {
+    if ((s.size() >= 2) && (s[0] =='-') && (s[1] == ch)) {
+        s = s.substr(2);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+// a number in 1..limit, throws std::invalid_argument otherwise
+size_t str_to_size(const std::string &s, size_t limit) {
+    size_t end = 0;
+    unsigned long long n = 0;
+    try {
+        // stoull takes "-1" as a huge number
+        if (!s.empty() && (s[0] != '-')) {
+            n = std::stoull(s, &end);
+        }
+    }
+    catch (const std::logic_error &) {
+    }
+    if ((n == 0) || (end != s.size()) || (n > limit)) {
+        throw std::invalid_argument("bad number " + s);
+    }
+    return static_cast<size_t>(n);
+}
+
+// Splits text into the tokens of a stats file. Words are made of letters, '-' and '\'' inside a word
+// are dropped as in the proper name files; test_word() rejects words with other symbols (e.g. non-ASCII).
+// Numbers start with a digit. Punctuation which breaks a phrase and empty lines become "$"
+class Corpus_Tokenizer {
+public:
+    Corpus_Tokenizer(const std::string_view &data, size_t pos): _data(data), _pos(pos), _comma(true), _newlines(0) {
+    }
+    // the next token and the offset of its beginning, false at the end of the data
+    bool next(std::string &token, size_t &start) {
+        while (_pos < _data.size()) {
+            char ch = _data[_pos];
+            if (is_letter(ch)) {
+                start = _pos;
+                read_word(token);
+                return true;
+            }
+            if (is_digit(ch)) {
+                start = _pos;
+                read_number(token);
+                return true;
+            }
+            bool comma = is_break(ch);
+            if (ch == '\n') {
+                comma = (++_newlines == 2);
+            }
+            else if ((ch != ' ') && (ch != '\t') && (ch != '\r')) {
+                _newlines = 0;
+            }
+            if (comma && !_comma) {
+                _comma = true;
+                start = _pos++;
+                token = "$";
+                return true;
+            }
+            _pos++;
+        }
+        return false;
+    }
+    static bool is_letter(char ch) {
+        return ((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) || (static_cast<unsigned char>(ch) >= 0x80);
+    }
+    static bool is_digit(char ch) {
+        return (ch >= '0') && (ch <= '9');
+    }
+    static bool is_break(char ch) {
+        return (ch == '.') || (ch == ',') || (ch == ';') || (ch == ':') || (ch == '!') || (ch == '?');
+    }
+    // a part of a corpus may start at the position, no token crosses it
+    static bool is_boundary(const std::string_view &data, size_t pos) {
+        if ((pos == 0) || (pos >= data.size())) {
+            return true;
+        }
+        char prev = data[pos - 1];
+        bool space = (prev == ' ') || (prev == '\t') || (prev == '\r') || (prev == '\n');
+        return space && (is_letter(data[pos]) || is_digit(data[pos]));
+    }
+private:
+    void read_word(std::string &token) {
+        token.clear();
+        while (_pos < _data.size()) {
+            char ch = _data[_pos];
+            if (is_letter(ch)) {
+                token += ch;
+            }
+            else if (((ch != '-') && (ch != '\'')) || (_pos + 1 >= _data.size()) || !is_letter(_data[_pos + 1])) {
+                break;
+            }
+            _pos++;
+        }
+        _comma = false;
+        _newlines = 0;
+    }
+    // digits and letters, "1,000" and "2.5" are one number
+    void read_number(std::string &token) {
+        token.clear();
+        while (_pos < _data.size()) {
+            char ch = _data[_pos];
+            bool separator = ((ch == ',') || (ch == '.')) && is_digit(token.back()) && (_pos + 1 < _data.size()) && is_digit(_data[_pos + 1]);
+            if (!is_letter(ch) && !is_digit(ch) && !separator) {
+                break;
+            }
+            token += ch;
+            _pos++;
+        }
+        _comma = false;
+        _newlines = 0;
+    }
+
+    std::string_view    _data;
+    size_t              _pos;
+    bool                _comma;     // the last token was "$"
+    size_t              _newlines;
+};
+
+// Sorted counts of one spill, the shards follow each other
+struct Ngram_Run {
+    std::string                         filename;
+    std::array<uint64_t, SHARDS + 1>    offsets;
+};
+
+// N-gram keys are the words joined by ' ', which sorts a prefix right before the n-grams continuing it
+class Ngram_Counter {
+public:
+    Ngram_Counter(const std::string &dir, size_t memory, std::atomic<size_t> &run_id):
+    _dir(dir), _memory(memory), _bytes(0), _run_id(run_id) {
+    }
+    void add(const std::string &key, size_t first_size) {
+        if (!_error.empty()) {
+            return;
+        }
+        auto &shard = _shards[std::hash<std::string_view>()(std::string_view(key).substr(0, first_size)) % SHARDS];
+        auto it = shard.find(key);
+        if (it != shard.end()) {
+            it->second++;
+            return;
+        }
+        shard.emplace(key, 1);
+        _bytes += key.size() + ENTRY_OVERHEAD;
+        if (_bytes >= _memory) {
+            spill();
+        }
+    }
+    void spill() {
+        if ((_bytes == 0) || !_error.empty()) {
+            return;
+        }
+        Ngram_Run run;
+        run.filename = (std::filesystem::path(_dir) / ("run_" + std::to_string(_run_id++) + ".tmp")).string();
+        std::ofstream file(run.filename, std::ios::binary);
+        std::vector<const std::pair<const std::string, uint64_t> *> list;
+        for (size_t s = 0; s < SHARDS; ++s) {
+            run.offsets[s] = static_cast<uint64_t>(file.tellp());
+            list.clear();
+            for (const auto &e: _shards[s]) {
+                list.push_back(&e);
+            }
+            std::sort(list.begin(), list.end(), [](const auto *a, const auto *b) {
+                return a->first < b->first;
+            });
+            for (const auto *e: list) {
+                write(file, e->first, e->second);
+            }
+            _shards[s] = Map_Type<std::string, uint64_t>();
+        }
+        run.offsets[SHARDS] = static_cast<uint64_t>(file.tellp());
+        file.close();
+        if (!file) {
+            _error = "Cannot write run file " + run.filename;
+        }
+        _runs.push_back(std::move(run));
+        _bytes = 0;
+    }
+    const std::vector<Ngram_Run> &runs() const {
+        return _runs;
+    }
+    // empty unless a run could not be written, the counting stops then
+    const std::string &error() const {
+        return _error;
+    }
+    static void write(std::ostream &file, const std::string &key, uint64_t count) {
+        uint32_t size = static_cast<uint32_t>(key.size());
+        file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        file.write(key.data(), static_cast<std::streamsize>(size));
+        file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    }
+private:
+    std::string         _dir;
+    size_t              _memory;
+    size_t              _bytes;
+    std::atomic<size_t> &_run_id;
+    std::array<Map_Type<std::string, uint64_t>, SHARDS> _shards;
+    std::vector<Ngram_Run>  _runs;
+    std::string         _error;
+};
+
+class Run_Reader {
+public:
+    Run_Reader(const Ngram_Run &run, size_t shard): _filename(run.filename), _file(run.filename, std::ios::binary),
+    _pos(run.offsets[shard]), _end(run.offsets[shard + 1]), _count(0), _failed(false) {
+        _file.seekg(static_cast<std::streamoff>(_pos));
+        _failed = !_file;
+    }
+    // false at the end of the shard and on a read error, which failed() tells
+    bool next() {
+        if (_failed || (_pos >= _end)) {
+            return false;
+        }
+        uint32_t size = 0;
+        _file.read(reinterpret_cast<char *>(&size), sizeof(size));
+        _pos += sizeof(size) + size + sizeof(_count);
+        if (!_file || (_pos > _end)) {
+            _failed = true;
+            return false;
+        }
+        _key.resize(size);
+        _file.read(&_key[0], static_cast<std::streamsize>(size));
+        _file.read(reinterpret_cast<char *>(&_count), sizeof(_count));
+        _failed = !_file;
+        return !_failed;
+    }
+    bool failed() const {
+        return _failed;
+    }
+    const std::string &filename() const {
+        return _filename;
+    }
+    const std::string &key() const {
+        return _key;
+    }
+    uint64_t count() const {
+        return _count;
+    }
+private:
+    std::string     _filename;
+    std::ifstream   _file;
+    uint64_t        _pos;
+    uint64_t        _end;
+    std::string     _key;
+    uint64_t        _count;
+    bool            _failed;
+};
+
+// Writes sorted n-grams as a tree of prefixes. An n-gram is written when the next one is known,
+// which tells whether it opens a prefix
+class Stats_Writer {
+public:
+    Stats_Writer(std::ostream &out): _out(out), _count(0), _pending(false) {
+    }
+    void add(const std::string &key, uint64_t count) {
+        if (_pending) {
+            flush(key);
+        }
+        _key = key;
+        _count = count;
+        _pending = true;
+    }
+    void finish() {
+        if (_pending) {
+            flush(std::string());
+            _pending = false;
+        }
+    }
+private:
+    bool continues(const std::string &next, size_t size) const {
+        return (next.size() > size) && (next[size] == ' ') && (next.compare(0, size, _key, 0, size) == 0);
+    }
+    void flush(const std::string &next) {
+        bool open = continues(next, _key.size());
+        size_t word = _key.rfind(' ');
+        word = (word == std::string::npos) ? 0 : word + 1;
+        _out << (open ? '+' : '=') << std::string_view(_key).substr(word) << ' ' << _count << '\n';
+        if (open) {
+            _open.push_back(_key.size());
+        }
+        while (!_open.empty() && !continues(next, _open.back())) {
+            _out << "-\n";
+            _open.pop_back();
+        }
+    }
+
+    std::ostream        &_out;
+    std::string         _key;
+    uint64_t            _count;
+    bool                _pending;
+    std::vector<size_t> _open;      // sizes of the opened prefixes of _key
+};
+
+// n-grams which start in [begin, end) of the data, the last ones may continue past the end
+void count_ngrams(const std::string_view &data, size_t begin, size_t end, Ngram_Counter &counter) {
+    Corpus_Tokenizer tokens(data, begin);
+    std::deque<std::pair<std::string, bool>> window;
+    std::string token;
+    std::string key;
+    size_t start = 0;
+    size_t outside = 0;
+    while ((outside < MAX_ORDER - 1) && tokens.next(token, start)) {
+        bool inside = (start < end);
+        outside += inside ? 0 : 1;
+        window.emplace_back(token, inside);
+        if (window.size() > MAX_ORDER) {
+            window.pop_front();
+        }
+        // every n-gram which ends with the token
+        for (size_t first = 0; first < window.size(); ++first) {
+            if (!window[first].second) {
+                continue;
+            }
+            key = window[first].first;
+            for (size_t i = first + 1; i < window.size(); ++i) {
+                key += ' ';
+                key += window[i].first;
+            }
+            counter.add(key, window[first].first.size());
+        }
+    }
+}
+
+// sums the counts of the shard in the runs, f(key, count) gets every n-gram in the order of the keys.
+// Returns an error, empty if all the runs have been read
+template <class _F>
+std::string merge_shard(std::vector<Ngram_Run>::const_iterator begin, std::vector<Ngram_Run>::const_iterator end, size_t shard, const _F &f) {
+    std::vector<std::unique_ptr<Run_Reader>> readers;
+    for (auto run = begin; run != end; ++run) {
+        if (run->offsets[shard] < run->offsets[shard + 1]) {
+            readers.push_back(std::make_unique<Run_Reader>(*run, shard));
+        }
+    }
+    auto greater = [&](size_t a, size_t b) {
+        return readers[a]->key() > readers[b]->key();
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> queue(greater);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (readers[i]->next()) {
+            queue.push(i);
+        }
+    }
+    std::string key;
+    while (!queue.empty()) {
+        size_t i = queue.top();
+        queue.pop();
+        key = readers[i]->key();
+        uint64_t count = readers[i]->count();
+        if (readers[i]->next()) {
+            queue.push(i);
+        }
+        while (!queue.empty() && (readers[queue.top()]->key() == key)) {
+            size_t j = queue.top();
+            queue.pop();
+            count += readers[j]->count();
+            if (readers[j]->next()) {
+                queue.push(j);
+            }
+        }
+        f(key, count);
+    }
+    for (const auto &r: readers) {
+        if (r->failed()) {
+            return "Cannot read run file " + r->filename();
+        }
+    }
+    return std::string();
+}
+
+// merges every fan_in runs into one run until at most fan_in are left, the merged ones are removed.
+// Returns an error, empty on success
+std::string reduce_runs(std::vector<Ngram_Run> &runs, size_t fan_in, const std::string &dir, std::atomic<size_t> &run_id, size_t threads) {
+    while (runs.size() > fan_in) {
+        std::vector<Ngram_Run> merged((runs.size() + fan_in - 1) / fan_in);
+        std::vector<std::string> errors(merged.size());
+        parallel_for(merged.size(), threads, [&](size_t i) {
+            auto begin = runs.begin() + static_cast<ptrdiff_t>(i * fan_in);
+            auto end = runs.begin() + static_cast<ptrdiff_t>(std::min(runs.size(), (i + 1) * fan_in));
+            Ngram_Run &run = merged[i];
+            run.filename = (std::filesystem::path(dir) / ("run_" + std::to_string(run_id++) + ".tmp")).string();
+            std::ofstream file(run.filename, std::ios::binary);
+            for (size_t s = 0; (s < SHARDS) && errors[i].empty(); ++s) {
+                run.offsets[s] = static_cast<uint64_t>(file.tellp());
+                errors[i] = merge_shard(begin, end, s, [&](const std::string &key, uint64_t count) {
+                    Ngram_Counter::write(file, key, count);
+                });
+            }
+            run.offsets[SHARDS] = static_cast<uint64_t>(file.tellp());
+            file.close();
+            if (!file && errors[i].empty()) {
+                errors[i] = "Cannot write run file " + run.filename;
+            }
+        });
+        std::error_code ec;
+        for (const auto &run: runs) {
+            std::filesystem::remove(run.filename, ec);
+        }
+        runs.swap(merged);
+        for (const auto &e: errors) {
+            if (!e.empty()) {
+                return e;
+            }
+        }
+    }
+    return std::string();
+}
+
+int main(int argc, char* args[]) {
+    std::vector<std::string> corpus_files;
+    std::string output = "stats.sts";
+    std::string temp_dir;
+    size_t threads = hardware_threads();
+    size_t memory = 1024;
+
+    try {
+        for(int p = 1; p < argc; ++p) {
+            std::string w = args[p];
+            if (option('o', w)) {
+                output = w;
+            }
+            else if (option('T', w)) {
+                temp_dir = w;
+            }
+            else if (option('t', w)) {
+                threads = str_to_size(w, MAX_THREADS_ARG);
+            }
+            else if (option('m', w)) {
+                memory = str_to_size(w, MAX_MEMORY_ARG);
+            }
+            else {
+                corpus_files.push_back(w);
+            }
+        }
+    }
+    catch (const std::invalid_argument &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        std::cout << "Usage: stats -o<output> [-t<threads>] [-m<memory MB>] [-T<temp dir>] file1.txt ..." << std::endl;
+        return 1;
+    }
+    if (temp_dir.empty()) {
+        temp_dir = output + ".tmp";
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(temp_dir, ec);
+
+    // pieces of the corpora start at token boundaries, every part takes about the same size
+    struct Piece {
+        size_t  file;
+        size_t  begin;
+        size_t  end;
+    };
+    std::vector<std::unique_ptr<Mapped_File>> files;
+    size_t total = 0;
+    for (const auto &fn: corpus_files) {
+        files.push_back(std::make_unique<Mapped_File>(fn));
+        if (!files.back()->ok()) {
+            std::cout << "Cannot read corpus file " << fn << std::endl;
+            return 1;
+        }
+        total += files.back()->size();
+    }
+    size_t target = std::max<size_t>(total / threads + 1, 1 << 20);
+    std::vector<std::vector<Piece>> parts(1);
+    size_t part_size = 0;
+    for (size_t f = 0; f < files.size(); ++f) {
+        std::string_view data = files[f]->view();
+        for (size_t begin = 0; begin < data.size();) {
+            size_t end = std::min(data.size(), begin + (target - part_size));
+            while (!Corpus_Tokenizer::is_boundary(data, end)) {
+                end++;
+            }
+            parts.back().push_back({f, begin, end});
+            part_size += end - begin;
+            if (part_size >= target) {
+                parts.emplace_back();
+                part_size = 0;
+            }
+            begin = end;
+        }
+    }
+
+    std::cout << "Counting n-grams (" << parts.size() << " part(s), " << threads << " thread(s))...";
+    std::atomic<size_t> run_id(0);
+    std::vector<Ngram_Run> runs;
+    std::mutex mtx;
+    std::string error;
+    parallel_for(parts.size(), threads, [&](size_t i) {
+        Ngram_Counter counter(temp_dir, (memory << 20) / threads, run_id);
+        for (const auto &piece: parts[i]) {
+            files[piece.file]->sequential(piece.begin, piece.end);
+            count_ngrams(files[piece.file]->view(), piece.begin, piece.end, counter);
+        }
+        counter.spill();
+        std::lock_guard<std::mutex> lock(mtx);
+        runs.insert(runs.end(), counter.runs().begin(), counter.runs().end());
+        if (error.empty()) {
+            error = counter.error();
+        }
+    });
+    if (!error.empty()) {
+        for (const auto &run: runs) {
+            std::filesystem::remove(run.filename, ec);
+        }
+        std::filesystem::remove(temp_dir, ec);
+        std::cout << " Failed" << std::endl;
+        std::cout << error << std::endl;
+        return 1;
+    }
+    std::cout << " Done (" << runs.size() << " run(s))" << std::endl;
+
+    std::cout << "Merging runs...";
+    error = reduce_runs(runs, std::max<size_t>(2, MAX_OPEN_RUNS / threads), temp_dir, run_id, threads);
+    std::vector<std::string> shard_files(SHARDS);
+    std::vector<size_t> counts(SHARDS);
+    std::vector<std::string> errors(SHARDS);
+    if (error.empty()) {
+        parallel_for(SHARDS, threads, [&](size_t s) {
+            shard_files[s] = (std::filesystem::path(temp_dir) / ("shard_" + std::to_string(s) + ".sts")).string();
+            std::ofstream out(shard_files[s], std::ios::binary);
+            Stats_Writer writer(out);
+            errors[s] = merge_shard(runs.cbegin(), runs.cend(), s, [&](const std::string &key, uint64_t count) {
+                writer.add(key, count);
+                counts[s]++;
+            });
+            writer.finish();
+            out.close();
+            if (!out && errors[s].empty()) {
+                errors[s] = "Cannot write shard file " + shard_files[s];
+            }
+        });
+    }
+    for (const auto &run: runs) {
+        std::filesystem::remove(run.filename, ec);
+    }
+    for (const auto &e: errors) {
+        if (error.empty()) {
+            error = e;
+        }
+    }
+    if (!error.empty()) {
+        for (const auto &fn: shard_files) {
+            std::filesystem::remove(fn, ec);
+        }
+        std::filesystem::remove(temp_dir, ec);
+        std::cout << " Failed" << std::endl;
+        std::cout << error << std::endl;
+        return 1;
+    }
+    std::cout << " Done" << std::endl;
+
+    std::cout << "Writing " << output << "...";
+    {
+        std::ofstream out(output, std::ios::binary);
+        for (const auto &fn: shard_files) {
+            std::ifstream in(fn, std::ios::binary);
+            if (in.peek() != std::ifstream::traits_type::eof()) {
+                out << in.rdbuf();
+            }
+            in.close();
+            std::filesystem::remove(fn, ec);
+        }
+        out.close();
+        if (!out) {
+            std::cout << " Failed" << std::endl;
+            std::cout << "Cannot write " << output << std::endl;
+            return 1;
+        }
+    }
+    std::filesystem::remove(temp_dir, ec);
+    size_t ngrams = 0;
+    for (size_t c: counts) {
+        ngrams += c;
+    }
+    std::cout << " Done (" << ngrams << " n-grams)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,22 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += c++17
+
+QMAKE_CXXFLAGS_WARN_ON += \
+    -Wall \
+    -Wextra \
+    -Wpedantic \
+    -Wconversion \
+    -Wsign-conversion
+
+SOURCES += \
+    stats.cpp
+
+HEADERS += \
+    snapshot.h \
+    arena.h \
+    mapped_file.h \
+    pipe_reader.h \
+    dict.h